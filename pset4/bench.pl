@@ -0,0 +1,295 @@
+#! /usr/bin/perl -w
+
+# bench.pl
+#    This program runs the io61 programs over a matrix of block sizes,
+#    strides, file sizes, and cache configurations. It records each
+#    run’s profiler report (the JSON written to file descriptor 100),
+#    saves the medians as JSON in `bench/COMMIT.json`, and prints a
+#    table comparing them with a saved baseline.
+#
+#    Usage: perl bench.pl [TRIALS=N] [BASELINE=FILE|COMMIT] [SAVE=1]
+#                         [THRESHOLD=F] [CONFIGS=C,C...] [PATTERN...]
+#
+#    PATTERNs select matrix rows whose names contain them. `SAVE=1`
+#    makes the results the new baseline (`bench/baseline.json`). Rows
+#    whose time grows by more than THRESHOLD (default 0.1, i.e., 10%)
+#    relative to the baseline are reported as regressions. CONFIGS lists
+#    `IO61` environment settings to try; `plain` means none, and `stdio`
+#    runs the stdio version of each program.
+#
+#    To add benchmarks, scroll down to the matrix. Each row has a name,
+#    a command with `{PARAMETER}` placeholders, and a list of values for
+#    each parameter; every combination is run in every configuration.
+
+use Time::HiRes;
+use POSIX;
+use Scalar::Util qw(looks_like_number);
+use List::Util qw(max);
+use JSON::PP;
+
+my %param = ("TRIALS" => 3, "THRESHOLD" => 0.1, "SAVE" => 0,
+             "CONFIGS" => "stdio,plain,readahead,uring");
+my @patterns;
+foreach my $arg (@ARGV) {
+    if ($arg =~ /\A([A-Z]+)=(.*)\z/s) {
+        $param{$1} = $2;
+    } elsif ($arg =~ /\A-/) {
+        die "Usage: perl bench.pl [TRIALS=N] [BASELINE=FILE|COMMIT] [SAVE=1] [THRESHOLD=F] [CONFIGS=C,C...] [PATTERN...]\n";
+    } else {
+        push @patterns, $arg;
+    }
+}
+$param{"TRIALS"} = 1 if !looks_like_number($param{"TRIALS"}) || $param{"TRIALS"} < 1;
+
+my ($Red, $Green, $Cyan, $Off) = ("\x1b[01;31m", "\x1b[01;32m", "\x1b[01;36m", "\x1b[0m");
+if (!-t STDOUT) {
+    $Red = $Green = $Cyan = $Off = "";
+}
+
+
+# input files (made by `gendata`, the same as check.pl’s; `.gz` files are
+# compressed with gzip)
+my %fileinfo;
+
+sub register_file ($$) {
+    my ($fname, $offset) = @_;
+    if ($fname !~ /\Ainputs\/(text|binary)(\d+)([mkg])(|-rev)(\.txt|\.bin)(|\.gz)\z/) {
+        die "*** $fname: invalid filename\n";
+    }
+    my ($sz) = $2 * ($3 eq "g" ? 1 << 30 : ($3 eq "m" ? 1 << 20 : 1 << 10));
+    $fileinfo{$fname} = [$sz, $offset];
+    return $fname;
+}
+
+# data size of a gzip file, from its trailer (modulo 2**32)
+sub gzip_size ($) {
+    my ($filename) = @_;
+    my ($buf) = "";
+    if (open(GZ, "<", $filename) && seek(GZ, -4, 2)) {
+        read(GZ, $buf, 4);
+    }
+    close(GZ);
+    return length($buf) == 4 ? unpack("V", $buf) : -1;
+}
+
+sub make_datafile ($) {
+    my ($filename) = @_;
+    my ($size, $seed) = @{$fileinfo{$filename}};
+    my ($gz) = $filename =~ /\.gz\z/ ? " | gzip -c" : "";
+    return if -r $filename
+        && ($gz ? gzip_size($filename) == $size % (1 << 32) : -s $filename == $size);
+    mkdir("inputs");
+    system("make -s gendata >/dev/null 2>&1") if !-x "./gendata";
+    my ($kind) = $filename =~ /\.bin(?:\.gz)?\z/ ? "binary" : "text";
+    my ($rev) = $filename =~ /-rev/ ? " | rev" : "";
+    system("./gendata -s $size -r $seed $kind$rev$gz > $filename") == 0
+        or die "*** $filename: cannot generate with ./gendata\n";
+}
+
+my ($textsm) = register_file("inputs/text90k.txt", 2 << 9);
+my ($binmd) = register_file("inputs/binary5m.bin", 4 << 9);
+my ($textmd) = register_file("inputs/text12m.txt", 5 << 9);
+my ($textlg) = register_file("inputs/text64m.txt", 6 << 9);
+my ($textxl) = register_file("inputs/text1g.txt", 7 << 9);
+my ($textlggz) = register_file("inputs/text64m.txt.gz", 6 << 9);
+
+
+# running commands
+
+sub run_bench ($$) {
+    my ($command, $config) = @_;
+    pipe(PR, PW) or die "pipe";
+    my ($before) = Time::HiRes::time();
+    my ($pid) = fork();
+    if ($pid == 0) {
+        close(PR);
+        POSIX::dup2(fileno(PW), 100);
+        close(PW);
+        my ($fd) = POSIX::open("/dev/null", O_RDWR);
+        POSIX::dup2($fd, 0);
+        POSIX::dup2($fd, 1);
+        POSIX::close($fd);
+        delete $ENV{"IO61"};
+        $ENV{"IO61"} = $config if $config ne "plain" && $config ne "stdio";
+        exec("/bin/sh", "-c", $command);
+        exit(1);
+    }
+    close(PW);
+    my ($buf, $data, $n) = ("", "");
+    while (defined(($n = POSIX::read(fileno(PR), $buf, 65536))) && $n > 0) {
+        $data .= substr($buf, 0, $n);
+    }
+    close(PR);
+    waitpid($pid, 0);
+    my ($status, $elapsed) = ($?, Time::HiRes::time() - $before);
+
+    # each process reports one line; io61 counters are summed
+    my (%answer);
+    foreach my $line (split(/\n/, $data)) {
+        my $j = eval { decode_json($line) };
+        next if ref($j) ne "HASH";
+        foreach my $k (keys %$j) {
+            next if ref($j->{$k}) || !looks_like_number($j->{$k});
+            if ($k =~ /\Aio61_/) {
+                $answer{$k} = ($answer{$k} // 0) + $j->{$k};
+            } else {
+                $answer{$k} = max($answer{$k} // 0, $j->{$k});
+            }
+        }
+    }
+    $answer{"time"} = $elapsed if !exists($answer{"time"});
+    $answer{"error"} = 1 if $status != 0;
+    return \%answer;
+}
+
+sub median (@) {
+    my (@x) = sort { $a <=> $b } @_;
+    return undef if !@x;
+    return @x % 2 ? $x[@x >> 1] : ($x[(@x >> 1) - 1] + $x[@x >> 1]) / 2;
+}
+
+sub expand ($$) {
+    my ($command, $axes) = @_;
+    my (@commands) = ([$command, ""]);
+    foreach my $axis (sort keys %$axes) {
+        my (@next);
+        foreach my $c (@commands) {
+            foreach my $v (@{$axes->{$axis}}) {
+                my ($cmd) = $c->[0];
+                $cmd =~ s/\{$axis\}/$v/g;
+                push @next, [$cmd, $c->[1] . ($c->[1] eq "" ? "" : " ") . "$axis=$v"];
+            }
+        }
+        @commands = @next;
+    }
+    return @commands;
+}
+
+
+# the matrix
+my @matrix;
+
+sub bench ($$%) {
+    my ($name, $command, %axes) = @_;
+    push @matrix, [$name, $command, \%axes];
+}
+
+bench("blockcat", "./blockcat61 -b {B} -o outputs/out.txt {FILE}",
+    "B" => [1, 509, 4096, 65536], "FILE" => [$textmd]);
+
+bench("cat", "./cat61 -o outputs/out.txt {FILE}",
+    "FILE" => [$textsm, $textmd, $textlg]);
+
+bench("blockcat-bin", "./blockcat61 -b {B} -o outputs/out.bin {FILE}",
+    "B" => [4096], "FILE" => [$binmd]);
+
+bench("blockcat-huge", "./blockcat61 -b {B} -o outputs/out.txt {FILE}",
+    "B" => [65536], "FILE" => [$textxl]);
+
+bench("reverse", "./reverse61 -o outputs/out.txt {FILE}",
+    "FILE" => [$textmd]);
+
+bench("stridecat", "./stridecat61 -t {T} -o outputs/out.txt {FILE}",
+    "T" => [2, 4096, "1m"], "FILE" => [$textmd]);
+
+bench("wreverse", "./wreverse61 -o outputs/out.txt {FILE}",
+    "FILE" => [$textsm]);
+
+bench("wstridecat", "./wstridecat61 -b {B} -t {T} -o outputs/out.txt {FILE}",
+    "B" => [8], "T" => [1024, 65536], "FILE" => [$textmd]);
+
+bench("copy", "./copy61 -j {J} -o outputs/out.txt {FILE}",
+    "J" => [1, 4], "FILE" => [$textlg]);
+
+# compressed input: io61’s decompression compared with a `zcat` pipe
+bench("gunzip", "IO61=\${IO61},gunzip ./cat61 -o outputs/out.txt {FILE}",
+    "FILE" => [$textlggz]);
+
+bench("zcat", "zcat {FILE} | ./cat61 -o outputs/out.txt",
+    "FILE" => [$textlggz]);
+
+
+# run it
+my @configs = split(/,/, $param{"CONFIGS"});
+my (%results, @order);
+mkdir("outputs");
+mkdir("bench");
+
+foreach my $row (@matrix) {
+    my ($name, $command, $axes) = @$row;
+    next if @patterns && !grep { index($name, $_) >= 0 } @patterns;
+    foreach my $c (expand($command, $axes)) {
+        my ($cmd, $desc) = @$c;
+        while ($cmd =~ /(inputs\/\S+)/g) {
+            make_datafile($1) if exists($fileinfo{$1});
+        }
+        foreach my $config (@configs) {
+            my ($run) = $cmd;
+            $run =~ s{(\./)([-a-z]*61)}{${1}stdio-$2}g if $config eq "stdio";
+            my ($key) = "$name $desc [$config]";
+            my (@trials) = map { run_bench($run, $config) } 1..$param{"TRIALS"};
+            my (%r);
+            foreach my $k (keys %{$trials[0]}) {
+                $r{$k} = median(map { $_->{$k} // 0 } @trials);
+            }
+            $r{"command"} = $run;
+            $results{$key} = \%r;
+            push @order, $key;
+            printf "%-56s %9.4fs%s\n", $key, $r{"time"},
+                $r{"error"} ? " ${Red}ERROR${Off}" : "";
+        }
+    }
+}
+
+my $commit = `git rev-parse --short HEAD 2>/dev/null` || "unknown";
+chomp $commit;
+$commit .= "-dirty" if `git status --porcelain --untracked-files=no . 2>/dev/null` ne "";
+my %report = ("commit" => $commit, "date" => POSIX::strftime("%Y-%m-%dT%H:%M:%S", localtime),
+              "trials" => $param{"TRIALS"}, "results" => \%results);
+my $json = JSON::PP->new->canonical(1)->pretty;
+open(OUT, ">", "bench/$commit.json") or die "bench/$commit.json: $!\n";
+print OUT $json->encode(\%report);
+close(OUT);
+print "\nResults saved in bench/$commit.json\n";
+
+
+# compare with the baseline
+my $basefile = $param{"BASELINE"} // "bench/baseline.json";
+$basefile = "bench/$basefile.json" if !-r $basefile && -r "bench/$basefile.json";
+if (-r $basefile && !$param{"SAVE"}) {
+    open(IN, "<", $basefile) or die "$basefile: $!\n";
+    my $base = eval { decode_json(join("", <IN>)) };
+    close(IN);
+    die "$basefile: not a benchmark report\n" if ref($base) ne "HASH" || ref($base->{"results"}) ne "HASH";
+
+    printf "\nCOMPARED WITH %s (%s)\n", $base->{"commit"}, $basefile;
+    printf "%-56s %10s %10s %8s %10s %10s\n", "BENCHMARK", "BASE", "NOW", "RATIO", "BASE SYS", "NOW SYS";
+    my ($nregress, $nimprove) = (0, 0);
+    foreach my $key (@order) {
+        my ($b, $r) = ($base->{"results"}->{$key}, $results{$key});
+        next if !$b || !$b->{"time"};
+        my $ratio = $r->{"time"} / $b->{"time"};
+        my ($color, $note) = ("", "");
+        if ($ratio > 1 + $param{"THRESHOLD"}) {
+            ($color, $note) = ($Red, " REGRESSION");
+            ++$nregress;
+        } elsif ($ratio < 1 / (1 + $param{"THRESHOLD"})) {
+            ($color, $note) = ($Green, "");
+            ++$nimprove;
+        }
+        printf "%-56s %9.4fs %9.4fs %s%7.2fx%s %10s %10s%s%s%s\n", $key,
+            $b->{"time"}, $r->{"time"}, $color, $ratio, $Off,
+            $b->{"io61_syscalls"} // "-", $r->{"io61_syscalls"} // "-",
+            $color, $note, $Off;
+    }
+    printf "\n%s%d regressions%s, %d improvements beyond %.0f%%\n",
+        $nregress ? $Red : $Green, $nregress, $Off, $nimprove, $param{"THRESHOLD"} * 100;
+    exit($nregress ? 1 : 0);
+} elsif ($param{"SAVE"}) {
+    open(OUT, ">", "bench/baseline.json") or die "bench/baseline.json: $!\n";
+    print OUT $json->encode(\%report);
+    close(OUT);
+    print "Saved as baseline bench/baseline.json\n";
+} else {
+    print "No baseline; run with SAVE=1 to save one\n";
+}
@@ -7,7 +7,7 @@
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("b:o:i:D:FRWy", 4096).parse(argc, argv);
+    io61_args args = io61_args("b:o:i:D:P:KLd:FRWy", 4096).parse(argc, argv);
 
     // Allocate buffer, open files
     unsigned char* buf = new unsigned char[args.block_size];
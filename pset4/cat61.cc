@@ -5,12 +5,13 @@
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("s:o:i:D:a:Fy").parse(argc, argv);
+    io61_args args = io61_args("s:o:i:D:a:Ld:Fy").parse(argc, argv);
 
     io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
     io61_file* outf = io61_open_check(args.output_file,
                                       O_WRONLY | O_CREAT | O_TRUNC);
-    args.after_open();
+    args.after_open(inf, O_RDONLY);
+    args.after_open(outf, O_WRONLY);
 
     while (args.file_size != 0) {
         int ch = io61_readc(inf);
@@ -77,18 +77,25 @@ sub decache ($) {
 sub make_datafile ($) {
     my ($filename) = @_;
     my ($size) = $fileinfo{$filename}->[2];
-    my ($cmd) = $filename =~ /-rev/ ? "rev" : "cat";
-    my ($src) = $filename =~ /\.bin$/ ? "/bin/sh" : "/usr/share/dict/words";
     die if $ROOT ne "" && $filename =~ /\A${ROOT}/;
     my ($rootfn) = "${ROOT}$filename";
-    my ($first_offset) = "";
-    if (defined($fileinfo{$filename}->[3]) && $fileinfo{$filename}->[3]) {
-        $first_offset = " | tail -c +" . $fileinfo{$filename}->[3];
-    }
     if (!-r $rootfn || !defined(-s $rootfn) || -s $rootfn != $size) {
-        while (!defined(-s $rootfn) || -s $rootfn < $size) {
-            system("$cmd $src$first_offset >> $rootfn");
-            $first_offset = "";
+        # `gendata` writes large files quickly; fall back to the
+        # dictionary if it can't be built
+        system("make -s gendata >/dev/null 2>&1") if !-x "./gendata" && !$param{"NOMAKE"};
+        my ($seed) = $fileinfo{$filename}->[3] // 0;
+        my ($kind) = $filename =~ /\.bin$/ ? "binary" : "text";
+        my ($rev) = $filename =~ /-rev/ ? " | rev" : "";
+        if (!-x "./gendata"
+            || system("./gendata -s $size -r $seed $kind$rev > $rootfn") != 0) {
+            my ($cmd) = $filename =~ /-rev/ ? "rev" : "cat";
+            my ($src) = $filename =~ /\.bin$/ ? "/bin/sh" : "/usr/share/dict/words";
+            my ($first_offset) = $seed ? " | tail -c +$seed" : "";
+            truncate($rootfn, 0);
+            while (!defined(-s $rootfn) || -s $rootfn < $size) {
+                system("$cmd $src$first_offset >> $rootfn");
+                $first_offset = "";
+            }
         }
         truncate($rootfn, $size);
     }
@@ -291,12 +298,27 @@ sub run_sh61 ($;%) {
         return $answer;
     }
 
-    $nb = POSIX::read(fileno(PR), $buf, 2000);
+    $nb = POSIX::read(fileno(PR), $buf, 65536);
     close(PR);
     $buf = $nb > 0 ? substr($buf, 0, $nb) : "";
 
-    while ($buf =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
-        $answer->{$1} = $2;
+    # each process in a pipeline reports one line; io61 counters are summed
+    foreach my $line (split(/\n/, $buf)) {
+        my $j = eval { decode_json($line) };
+        if (ref($j) eq "HASH") {
+            foreach my $k (keys %$j) {
+                next if ref($j->{$k}) || !looks_like_number($j->{$k});
+                if ($k =~ /\Aio61_/) {
+                    $answer->{$k} = ($answer->{$k} // 0) + $j->{$k};
+                } else {
+                    $answer->{$k} = $j->{$k};
+                }
+            }
+        } else {
+            while ($line =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
+                $answer->{$1} = $2;
+            }
+        }
     }
     $answer->{"time"} = $delta if !defined($answer->{"time"});
     $answer->{"time"} = $delta if $answer->{"time"} <= 0.95 * $delta;
@@ -455,7 +477,7 @@ sub add_make_targets ($) {
         push @t, $1;
     }
     foreach my $t (@t) {
-        next if $command !~ m/(?:\A|[|&;]\s*|'\|'\s*|\.\/socketpipe\s*(?:-B\s*\d+\s*|))$t/;
+        next if $command !~ m/(?:\A|[|&;]\s*|'\|'\s*|\.\/socketpipe\s*(?:-B\s*\d+\s*|))(?:[A-Z0-9_]+=\S*\s+)*$t/;
         $t = substr($t, 2);
         if (!exists($MAKE_TARGETS{$t})) {
             push @MAKE_TARGETS, $t;
@@ -965,6 +987,12 @@ sub run () {
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"} / 1024.0,
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
             push @runtimes, $tt->{"time"};
+            if ($param{"STATS"} && defined($tt->{"io61_syscalls"})) {
+                printf("IO61 STATS: %d syscalls, %d bytes read, %d bytes written, %d hits, %d misses\n",
+                       $tt->{"io61_syscalls"}, $tt->{"io61_bytes_read"},
+                       $tt->{"io61_bytes_written"}, $tt->{"io61_hits"},
+                       $tt->{"io61_misses"});
+            }
         }
 
         # print stdio vs. yourcode comparison
@@ -1091,7 +1119,9 @@ sub summary () {
     "MAKESILENT" => boolenv("MAKESILENT"),
     "NOMAKE" => boolenv("NOMAKE"),
     "STRACE" => boolenv("STRACE"),
-    "TMP" => nonemptyenv("TMP") ? boolenv("TMP") : undef
+    "STATS" => boolenv("STATS"),
+    "TMP" => nonemptyenv("TMP") ? boolenv("TMP") : undef,
+    "IO61" => nonemptyenv("IO61") ? $ENV{"IO61"} : undef
 );
 
 while (@ARGV) {
@@ -1099,9 +1129,9 @@ while (@ARGV) {
         $SEQTEST = 0;
     } elsif ($ARGV[0] eq "-V") {
         $VERBOSE = 1;
-    } elsif ($ARGV[0] =~ /\A([A-Z]+)=(\d*)\z/) {
+    } elsif ($ARGV[0] =~ /\A([A-Z][A-Z0-9]*)=(\d*)\z/ && $1 ne "IO61") {
         $param{$1} = $2 eq "" ? 0 : int($2);
-    } elsif ($ARGV[0] =~ /\A([A-Z]+)=(.*)\z/s) {
+    } elsif ($ARGV[0] =~ /\A([A-Z][A-Z0-9]*)=(.*)\z/s) {
         $param{$1} = $2;
     } else {
         push @ALLOW_TESTS, "XXXXX" if !@ALLOW_TESTS;
@@ -1120,6 +1150,11 @@ $param{"MAXTIME"} = 20 if $param{"MAXTIME"} <= 0;
 $param{"NOSTDIO"} = 1 if $param{"STRACE"};
 $param{"DOCKER"} = -e "/usr/bin/cs61-docker-version" ? 1 : 0 if !defined($param{"DOCKER"});
 $param{"TMP"} = $param{"DOCKER"} if !defined($param{"TMP"});
+if (defined($param{"IO61"}) && $param{"IO61"} ne "") {
+    # time your code with the requested io61 backend (stdio ignores it)
+    $ENV{"IO61"} = $param{"IO61"};
+    print STDERR "IO61 MODE: ", $param{"IO61"}, "\n";
+}
 $FILECHECKSUM = $VERBOSE || $param{"MAKETRIALLOG"} || defined($param{"TRIALLOG"}) || $param{"CACHE"};
 
 # maybe read a trial log
@@ -1210,6 +1245,7 @@ my ($binsm) = register_file("inputs/binary40k.bin", 4 << 9);
 my ($binmd) = register_file("inputs/binary5m.bin", 4 << 9);
 my ($textmd) = register_file("inputs/text12m.txt", 5 << 9);
 my ($textlg) = register_file("inputs/text64m.txt", 6 << 9);
+my ($textxl) = register_file("inputs/text1g.txt", 7 << 9);
 
 $SIG{"INT"} = sub {
     kill 9, -$run61_pid if $run61_pid;
@@ -1496,6 +1532,327 @@ enqueue("LPN6",
     "regular large file, 1-4KiB block I/O, seek table order, limited memory");
 
 
+# READ-AHEAD
+enqueue("RA1",
+    "IO61=readahead ./cat61 -o outputs/out.txt $texttiny",
+    "read-ahead, byte I/O, sequential correctness",
+    "perf" => 0, "expect" => $texttiny);
+
+enqueue("RA2",
+    "cat $texttiny | IO61=readahead ./blockcat61 -b 1021 | cat > outputs/out.txt",
+    "read-ahead, 1021B block I/O, piped, sequential correctness",
+    "perf" => 0, "expect" => $texttiny);
+
+enqueue("RA3",
+    "IO61=readahead ./reverse61 $texttiny > outputs/c13.txt",
+    "read-ahead, byte I/O, correctness for reverse reads",
+    "perf" => 0, "compare" => 1);
+
+enqueue("RA4",
+    "IO61=readahead ./cat61 -o outputs/out.txt $textmd",
+    "read-ahead, regular medium file, byte I/O, sequential");
+
+enqueue("RA5",
+    "./blockcat61 -y $textmd | IO61=readahead ./cat61 | cat > outputs/out.txt",
+    "read-ahead, slow producer, byte I/O, sequential");
+
+
+# IO_URING
+#    These run the io_uring backend regardless of the IO61 parameter; use
+#    `make check IO61=uring` to time every test with it.
+enqueue("UR1",
+    "cat $texttiny | IO61=uring ./blockcat61 -b 1021 | cat > outputs/out.txt",
+    "io_uring, 1021B block I/O, piped, sequential correctness",
+    "perf" => 0, "expect" => $texttiny);
+
+enqueue("UR2",
+    "IO61=uring ./scattergather61 -b 509 -o outputs/c19a.txt -o outputs/c19b.txt -o outputs/c19c.txt -o outputs/c19d.txt -i $textsm -i $revtextsm -i $textsm",
+    "io_uring, scatter/gather 4/3 files, 509B block I/O, sequential",
+    "perf" => 0, "compare" => 1);
+
+enqueue("UR3",
+    "cp $texttiny outputs/c12.txt; ./cat61 -s 1992 $texttiny | IO61=uring ./writeat61 -o outputs/c12.txt -p 8188",
+    "io_uring, byte I/O, seek correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("UR4",
+    "IO61=uring ./reverse61 $texttiny > outputs/c13.txt",
+    "io_uring, byte I/O, correctness for reverse reads",
+    "perf" => 0, "compare" => 1);
+
+enqueue("UR5",
+    "IO61=uring ./wreverse61 $texttiny > outputs/c14.txt",
+    "io_uring, byte I/O, correctness for reverse writes",
+    "perf" => 0, "compare" => 1);
+
+enqueue("UR6",
+    "IO61=uring ./blockcat61 -b 1024 -o outputs/out.txt $textmd",
+    "io_uring, regular medium file, 1KB block I/O, sequential");
+
+enqueue("UR7",
+    "IO61=uring ./reverse61 -o outputs/out.txt $textmd",
+    "io_uring, regular medium file, byte I/O, reverse order");
+
+
+# ZERO-COPY
+enqueue("CP1",
+    "./copy61 -o outputs/out.txt $texttiny",
+    "io61_copy, regular small file, sequential correctness",
+    "perf" => 0, "expect" => $texttiny);
+
+enqueue("CP2",
+    "./copy61 -p 8188 -o outputs/cp2.txt $texttiny",
+    "io61_copy, correctness after seek",
+    "perf" => 0, "compare" => 1);
+
+enqueue("CP3",
+    "./copy61 -b 100000 -o outputs/out.txt $textmd",
+    "io61_copy, regular medium file, alternating with 100000B block I/O",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("CP4",
+    "cat $textmd | ./copy61 | cat > outputs/out.txt",
+    "io61_copy, piped medium file, sequential",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("CP5",
+    "./socketpipe ./copy61 $textmd '|' ./copy61 -o outputs/out.txt",
+    "io61_copy, medium file over a socket, sequential",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("CP6",
+    "./copy61 -o outputs/out.txt $textlg",
+    "io61_copy, regular large file, sequential");
+
+
+# VECTORED I/O
+enqueue("RV1",
+    "./recordwrite61 -o outputs/rv1.txt $texttiny",
+    "vectored I/O, 13B fields, sequential correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("RV2",
+    "cat $textsm | ./recordwrite61 -b 1021 | cat > outputs/rv2.txt",
+    "vectored I/O, 1021B fields, piped, sequential correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("RV3",
+    "./recordwrite61 -b 5000 -o outputs/rv3.txt $textmd",
+    "vectored I/O, 5000B fields, sequential correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("RV4",
+    "./recordwrite61 -o outputs/out.txt $textmd",
+    "vectored I/O, regular medium file, 13B fields, sequential");
+
+enqueue("RV5",
+    "./recordwrite61 -b 100000 -o outputs/out.txt $textlg",
+    "vectored I/O, regular large file, 100000B fields, sequential");
+
+
+# LINES
+enqueue("RL1",
+    "./scattergather61 -b 7 -l -o outputs/rl1a.txt -o outputs/rl1b.txt -i $textsm -i $revtextsm",
+    "scatter/gather 2/2 files by lines, short lines, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("RL2",
+    "./scattergather61 -b 100000 -l -o outputs/rl2a.bin -o outputs/rl2b.bin $binmd",
+    "scatter by lines, long lines, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("RL3",
+    "cat $textmd | ./scattergather61 -b 4096 -l | cat > outputs/out.txt",
+    "line I/O, piped medium file, sequential",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("RL4",
+    "./scattergather61 -b 4096 -l -o outputs/out.txt $textlg",
+    "line I/O, regular large file, sequential");
+
+
+# NONBLOCKING AND PIPES
+#    `-K` makes the program’s files nonblocking, and `-P` sets pipe
+#    buffer sizes. stdio doesn’t support nonblocking files.
+enqueue("NB1",
+    "cat $textmd | ./blockcat61 -K -b 65536 | cat > outputs/out.txt",
+    "nonblocking pipes, medium file, sequential correctness",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("NB2",
+    "./blockcat61 -b 997 -y $textsm | ./blockcat61 -K -P 4096 -b 8192 | cat > outputs/out.txt",
+    "nonblocking pipes, bursty producer, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("NB3",
+    "./socketpipe ./blockcat61 -K $textmd '|' ./blockcat61 -K -b 65536 -o outputs/out.txt",
+    "nonblocking socket, medium file, sequential correctness",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("NB4",
+    "cat $textmd | ./copy61 -K -P 16384 | cat > outputs/out.txt",
+    "io61_copy, nonblocking pipes, medium file, sequential correctness",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("NB5",
+    "cat $textlg | ./blockcat61 -P 1m | cat > outputs/out.txt",
+    "1MiB pipes, large file, sequential");
+
+
+# AUTO-FLUSH
+#    `-L` flushes output after each line; `-d` flushes output that has
+#    been cached longer than a deadline.
+enqueue("AF1",
+    "cat $textsm | ./blockcat61 -L -b 64 | ./cat61 -L > outputs/out.txt",
+    "line-flushed pipes, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("AF2",
+    "./blockcat61 -d 0.001 -b 997 -y $textsm | ./cat61 -d 0.01 | cat > outputs/out.txt",
+    "deadline-flushed pipes, slow producer, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("AF3",
+    "cat $textmd | ./cat61 -L | cat > outputs/out.txt",
+    "line-flushed pipe, medium file, bytewise");
+
+enqueue("AF4",
+    "./blockcat61 -L -b 4096 -o outputs/out.txt $textlg",
+    "line-flushed regular large file, 4096B blocks");
+
+enqueue("AF5",
+    "tr '\\n' '\\0' < $textmd | ./blockcat61 -K -L -b 1000 | (sleep 1; tr '\\0' '\\n') > outputs/out.txt",
+    "line-flushed nonblocking pipe, one long line, stalled reader, sequential correctness",
+    "perf" => 0, "expect" => $textmd);
+
+
+# PARALLEL COPY
+#    Compare PC4-6 to see how `io61_copy_parallel` scales with threads;
+#    run with `TMP=1` to keep files on a memory-backed file system.
+enqueue("PC1",
+    "./copy61 -j 4 -o outputs/out.txt $textmd",
+    "parallel copy, 4 threads, regular medium file, correctness",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("PC2",
+    "./copy61 -j 3 -b 100000 -p 1000 -o outputs/pc2.txt $textmd",
+    "parallel copy, 3 threads, alternating with block I/O after seek",
+    "perf" => 0, "compare" => 1);
+
+enqueue("PC3",
+    "cat $textmd | ./copy61 -j 4 | cat > outputs/out.txt",
+    "parallel copy, piped medium file, sequential",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("PC4",
+    "./copy61 -j 1 -o outputs/out.txt $textlg",
+    "parallel copy, 1 thread, regular large file");
+
+enqueue("PC5",
+    "./copy61 -j 2 -o outputs/out.txt $textlg",
+    "parallel copy, 2 threads, regular large file");
+
+enqueue("PC6",
+    "./copy61 -j 4 -o outputs/out.txt $textlg",
+    "parallel copy, 4 threads, regular large file");
+
+
+# DIRECT I/O
+#    These bypass the page cache with O_DIRECT where the file system
+#    allows it. Compare DI5 with DI6 for throughput and memory use.
+enqueue("DI1",
+    "IO61=direct ./blockcat61 -b 5000 -F -o outputs/di1.txt $textmd",
+    "O_DIRECT, 5000B blocks flushed with partial blocks, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("DI2",
+    "IO61=direct ./cat61 -s 1000001 -o outputs/di2.txt $textmd",
+    "O_DIRECT, byte I/O, unaligned file size, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("DI3",
+    "IO61=direct ./stridecat61 -s 300000 -t 5000 -o outputs/di3.txt $textmd",
+    "O_DIRECT, strided reads, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("DI4",
+    "IO61=direct ./wstridecat61 -s 300000 -t 5000 -o outputs/di4.txt $textmd",
+    "O_DIRECT, strided writes, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("DI5",
+    "IO61=direct ./blockcat61 -b 65536 -o outputs/out.txt $textlg",
+    "O_DIRECT, regular large file, 65536B blocks, sequential");
+
+enqueue("DI6",
+    "./blockcat61 -b 65536 -o outputs/out.txt $textlg",
+    "page cache, regular large file, 65536B blocks, sequential");
+
+
+# WRITE COALESCING
+#    Seeks within the write cache keep it, so nearby and reversed writes
+#    are flushed as a few large ranges. WC4 and WC5 compare with stdio.
+enqueue("WC1",
+    "./wreverse61 -s 1000001 -o outputs/wc1.txt $textmd",
+    "reversed byte writes, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("WC2",
+    "./wstridecat61 -b 3 -t 17 -o outputs/wc2.txt $textsm",
+    "short strides within the cache, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("WC3",
+    "./wstridecat61 -b 700 -t 5000 -o outputs/wc3.bin $binsm",
+    "strides around the cache size, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("WC4",
+    "./wreverse61 -o outputs/out.txt $textsm",
+    "reversed byte writes");
+
+enqueue("WC5",
+    "./wstridecat61 -b 8 -t 1024 -o outputs/out.txt $textmd",
+    "8B blocks at 1024B strides");
+
+
+# COMPRESSED STREAMS
+#    `IO61=gunzip` decompresses gzip input; `IO61=gzip` also compresses
+#    output. Run `perl bench.pl gunzip zcat` to compare throughput with
+#    a `zcat` pipe.
+enqueue("GZ1",
+    "gzip -c $textmd | IO61=gunzip ./cat61 | cat > outputs/out.txt",
+    "decompressed pipe, sequential correctness",
+    "perf" => 0, "expect" => $textmd);
+
+enqueue("GZ2",
+    "gzip -c $textsm > outputs/gz2.gz; IO61=gunzip ./blockcat61 -b 509 -o outputs/out.txt outputs/gz2.gz",
+    "decompressed regular file, 509B blocks, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("GZ3",
+    "(head -c 50000 $textsm | gzip -c; tail -c +50001 $textsm | gzip -c) | IO61=gunzip ./cat61 > outputs/out.txt",
+    "concatenated gzip members, sequential correctness",
+    "perf" => 0, "expect" => $textsm);
+
+enqueue("GZ4",
+    "IO61=gunzip ./reverse61 -o outputs/gz4.txt $textsm",
+    "uncompressed input stays seekable, correctness",
+    "perf" => 0, "compare" => 1);
+
+enqueue("GZ5",
+    "IO61=gzip ./blockcat61 -b 4096 -F $textmd | gzip -dc > outputs/out.txt",
+    "compressed output, flushed blocks, sequential correctness",
+    "perf" => 0, "expect" => $textmd);
+
+
+# HUGE FILES
+#    The 1GiB input is made by `gendata`; these tests measure throughput.
+enqueue("HF1",
+    "./blockcat61 -b 65536 -o outputs/out.txt $textxl",
+    "regular huge file, 64KiB block I/O, sequential");
+
+
 run();
 
 summary();
@@ -0,0 +1,65 @@
+#include "io61.hh"
+
+// Usage: ./copy61 [-b BLOCKSIZE] [-s SIZE] [-p POS] [-j THREADS]
+//                 [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE using `io61_copy`, starting at
+//    input position POS. With `-b`, alternates between copying BLOCKSIZE
+//    bytes through a buffer and BLOCKSIZE bytes with `io61_copy`. With
+//    `-j`, uses `io61_copy_parallel` with THREADS worker threads.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("b:s:p:j:o:i:D:P:KFy").parse(argc, argv);
+
+    // Allocate buffer, open files
+    unsigned char* buf = nullptr;
+    if (args.block_size != 0) {
+        buf = new unsigned char[args.block_size];
+    }
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    args.after_open(inf, O_RDONLY);
+    args.after_open(outf, O_WRONLY);
+
+    if (args.initial_offset != 0) {
+        int r = io61_seek(inf, args.initial_offset);
+        assert(r == 0);
+    }
+
+    // Copy file data
+    while (args.file_size != 0) {
+        size_t n = args.file_size;
+        if (buf) {
+            n = std::min(n, args.block_size);
+            ssize_t nr = io61_read(inf, buf, n);
+            if (nr <= 0) {
+                break;
+            }
+            ssize_t nw = io61_write(outf, buf, nr);
+            assert(nw == nr);
+            args.file_size -= nr;
+            n = std::min(args.file_size, args.block_size);
+        }
+
+        ssize_t nc;
+        if (args.nthreads > 1) {
+            nc = io61_copy_parallel(inf, outf, n, args.nthreads);
+        } else {
+            nc = io61_copy(inf, outf, n);
+        }
+        if (nc < 0) {
+            fprintf(stderr, "copy61: %s\n", strerror(errno));
+            exit(1);
+        } else if (nc == 0 && n != 0) {
+            break;
+        }
+        args.file_size -= nc;
+
+        args.after_write(outf);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    delete[] buf;
+}
@@ -0,0 +1,257 @@
+#include "io61.hh"
+#include <cerrno>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Usage: ./gendata -s SIZE [-r SEED] [-o OUTFILE] [KIND]
+//    Writes SIZE bytes of deterministic test data to OUTFILE (default
+//    standard output). The same SEED, KIND, and SIZE always produce the
+//    same data, and a shorter file is a prefix of a longer one. KIND is:
+//
+//    text          Dictionary-like words, one per line (default)
+//    binary        Mixed 64-byte records: zeros, counters, random bytes,
+//                  and short strings
+//    compressible  Lines built from a small set of repeated phrases
+//    random        Uniformly random bytes
+//
+//    A regular OUTFILE is preallocated and filled through `mmap`;
+//    otherwise data is written in 1MiB blocks.
+
+enum gen_kind { gen_text, gen_binary, gen_compressible, gen_random };
+
+// splitmix64: a fast generator with good statistical quality
+struct splitmix64 {
+    uint64_t state;
+    explicit splitmix64(uint64_t seed)
+        : state(seed) {
+    }
+    uint64_t operator()() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+struct generator {
+    gen_kind kind;
+    splitmix64 engine;
+    std::string pending;     // generated data not yet returned
+    size_t pos = 0;          // offset of next byte in `pending`
+    std::vector<char> words;            // for `gen_text`: 16-byte slots,
+    std::vector<unsigned char> wordlen; // each holding a word and newline
+    std::vector<std::string> phrases;   // for `gen_compressible`
+
+    generator(gen_kind kind, unsigned seed);
+    void fill(unsigned char* buf, size_t sz);
+
+  private:
+    void make_word(std::string& s);
+    void refill();
+};
+
+generator::generator(gen_kind kind_, unsigned seed)
+    : kind(kind_), engine(seed) {
+    if (kind == gen_text) {
+        // Text draws from a fixed dictionary, like /usr/share/dict/words
+        words.resize(8192 * 16);
+        for (int i = 0; i != 8192; ++i) {
+            std::string s;
+            make_word(s);
+            s += '\n';
+            memcpy(&words[i * 16], s.data(), s.size());
+            wordlen.push_back(s.size());
+        }
+    } else if (kind == gen_compressible) {
+        for (int i = 0; i != 64; ++i) {
+            std::string s;
+            while (s.size() < 24) {
+                make_word(s);
+                s += ' ';
+            }
+            phrases.push_back(std::move(s));
+        }
+    }
+}
+
+// generator::make_word(s)
+//    Append a word to `s`. Letters follow English frequencies, roughly.
+
+void generator::make_word(std::string& s) {
+    static const char freq[] =
+        "eeeeeeeeeeeetttttttttaaaaaaaaooooooooiiiiiiinnnnnnnsssssshhhhhh"
+        "rrrrrrddddlllluuucccmmmwwffggyyppbbvkjxqz";
+    static char letters[256];
+    if (!letters[0]) {
+        for (int i = 0; i != 256; ++i) {
+            letters[i] = freq[i * (sizeof(freq) - 1) / 256];
+        }
+    }
+    char w[16];
+    uint64_t r = engine();
+    unsigned len = 2 + r % 11;
+    unsigned first = 0;
+    if ((r >> 4) % 16 == 0) {
+        w[0] = char('A' + (r >> 8) % 26);
+        first = 1;
+    }
+    r = engine();
+    uint64_t r2 = engine();
+    for (unsigned i = first; i != len; ++i) {
+        w[i] = letters[i < 8 ? (r >> (8 * i)) & 0xFF : (r2 >> (8 * (i - 8))) & 0xFF];
+    }
+    s.append(w, len);
+}
+
+
+// generator::refill()
+//    Replace `pending` with about 64KiB of new data.
+
+void generator::refill() {
+    pending.clear();
+    pos = 0;
+    while (pending.size() < 65536) {
+        switch (kind) {
+        case gen_text: {
+            // Copy whole slots, then trim: faster than appending words
+            size_t n = pending.size();
+            pending.resize(n + 8 * 16);
+            for (int i = 0; i != 2; ++i) {
+                uint64_t r = engine();
+                for (int j = 0; j != 4; ++j, r >>= 16) {
+                    unsigned w = r % 8192;
+                    memcpy(&pending[n], &words[w * 16], 16);
+                    n += wordlen[w];
+                }
+            }
+            pending.resize(n);
+            break;
+        }
+        case gen_binary: {
+            uint64_t r = engine();
+            size_t start = pending.size();
+            if (r % 4 == 0) {
+                pending.append(64, '\0');
+            } else if (r % 4 == 1) {
+                for (uint32_t x = r >> 32, i = 0; i != 16; ++i, ++x) {
+                    pending.append(reinterpret_cast<const char*>(&x), 4);
+                }
+            } else if (r % 4 == 2) {
+                for (int i = 0; i != 8; ++i) {
+                    uint64_t x = engine();
+                    pending.append(reinterpret_cast<const char*>(&x), 8);
+                }
+            } else {
+                make_word(pending);
+                pending.resize(start + 64, '\0');
+            }
+            break;
+        }
+        case gen_compressible: {
+            uint64_t r = engine();
+            for (int i = 0; i != 1 + int(r % 10); ++i) {
+                pending += phrases[(r >> (4 + 6 * i)) % phrases.size()];
+            }
+            pending.back() = '\n';
+            break;
+        }
+        case gen_random:
+            for (int i = 0; i != 1024; ++i) {
+                uint64_t x = engine();
+                pending.append(reinterpret_cast<const char*>(&x), 8);
+            }
+            break;
+        }
+    }
+}
+
+// generator::fill(buf, sz)
+//    Write the next `sz` bytes of data into `buf`.
+
+void generator::fill(unsigned char* buf, size_t sz) {
+    while (sz != 0) {
+        if (pos == pending.size()) {
+            refill();
+        }
+        size_t n = std::min(sz, pending.size() - pos);
+        memcpy(buf, &pending[pos], n);
+        pos += n;
+        buf += n;
+        sz -= n;
+    }
+}
+
+
+[[noreturn]] static void usage() {
+    fprintf(stderr, "Usage: ./gendata -s SIZE [-r SEED] [-o OUTFILE] [text|binary|compressible|random]\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("s:r:o:").parse(argc, argv);
+    const char* kindstr = args.input_file ? args.input_file : "text";
+    gen_kind kind;
+    if (strcmp(kindstr, "text") == 0) {
+        kind = gen_text;
+    } else if (strcmp(kindstr, "binary") == 0) {
+        kind = gen_binary;
+    } else if (strcmp(kindstr, "compressible") == 0) {
+        kind = gen_compressible;
+    } else if (strcmp(kindstr, "random") == 0) {
+        kind = gen_random;
+    } else {
+        usage();
+    }
+    if (args.file_size == SIZE_MAX) {
+        usage();
+    }
+    generator gen(kind, args.engine());
+
+    // Open output
+    int fd = STDOUT_FILENO;
+    if (args.output_file) {
+        fd = open(args.output_file, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", args.output_file, strerror(errno));
+            exit(1);
+        }
+    }
+
+    // Regular files are preallocated and filled in place
+    struct stat st;
+    size_t sz = args.file_size;
+    if (sz != 0
+        && fstat(fd, &st) == 0
+        && S_ISREG(st.st_mode)
+        && ftruncate(fd, sz) == 0) {
+        posix_fallocate(fd, 0, sz);   // a hint: failure is OK
+        void* p = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+        if (p != MAP_FAILED) {
+            gen.fill(reinterpret_cast<unsigned char*>(p), sz);
+            munmap(p, sz);
+            close(fd);
+            return 0;
+        }
+    }
+
+    // Otherwise write 1MiB blocks
+    std::vector<unsigned char> buf(1 << 20);
+    while (sz != 0) {
+        size_t n = std::min(sz, buf.size());
+        gen.fill(buf.data(), n);
+        for (size_t off = 0; off != n; ) {
+            ssize_t nw = write(fd, &buf[off], n - off);
+            if (nw > 0) {
+                off += nw;
+            } else if (nw == -1 && errno != EINTR) {
+                fprintf(stderr, "gendata: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+        sz -= n;
+    }
+    close(fd);
+}
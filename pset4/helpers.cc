@@ -3,6 +3,8 @@
 #include <csignal>
 #include <climits>
 #include <cerrno>
+#include <mutex>
+#include <string>
 #include <sys/time.h>
 #include <sys/resource.h>
 
@@ -236,6 +238,23 @@ io61_args& io61_args::parse(int argc, char** argv) {
         case 'K':
             this->nonblocking = true;
             break;
+        case 'L':
+            this->line_flush = true;
+            break;
+        case 'j': {
+            long n = strtol(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr || n <= 0 || n > 1024) {
+                goto usage;
+            }
+            this->nthreads = n;
+            break;
+        }
+        case 'd':
+            this->flush_deadline = strtod(optarg, &endptr);
+            if (endptr == optarg || *endptr || this->flush_deadline < 0) {
+                goto usage;
+            }
+            break;
         case 'q':
             this->quiet = true;
             break;
@@ -396,6 +415,12 @@ void io61_args::usage() {
     if (strchr(this->opts, 'F')) {
         fprintf(stderr, "    -F            Flush after each write\n");
     }
+    if (strchr(this->opts, 'L')) {
+        fprintf(stderr, "    -L            Flush output after each line\n");
+    }
+    if (strchr(this->opts, 'd')) {
+        fprintf(stderr, "    -d DEADLINE   Flush output cached for DEADLINE seconds\n");
+    }
     if (strchr(this->opts, 'y')) {
         fprintf(stderr, "    -y            Yield after each write\n");
     }
@@ -414,6 +439,9 @@ void io61_args::usage() {
     if (strchr(this->opts, 'r')) {
         fprintf(stderr, "    -r            Set random seed (default %u)\n", this->seed);
     }
+    if (strchr(this->opts, 'j')) {
+        fprintf(stderr, "    -j THREADS    Copy with THREADS worker threads\n");
+    }
     if (strchr(this->opts, 'D')) {
         fprintf(stderr, "    -D DELAY      Delay before starting\n");
     }
@@ -450,6 +478,12 @@ void io61_args::after_open(int fd, int mode) {
 }
 
 void io61_args::after_open(io61_file* f, int mode) {
+    if ((mode & O_ACCMODE) != O_RDONLY
+        && (this->line_flush || this->flush_deadline > 0)) {
+        int r = io61_set_autoflush(f, this->line_flush ? IO61_FLUSH_LINE
+                                   : IO61_FLUSH_FULL, this->flush_deadline);
+        assert(r == 0);
+    }
     this->after_open(io61_fileno(f), mode);
 }
 
@@ -487,6 +521,58 @@ void io61_args::after_write(FILE* f) {
 
 namespace {
 
+std::mutex stats_mutex;
+std::vector<io61_stats> stats_list;
+
+}
+
+// io61_record_stats(stats)
+//    Remember the counters of a closed io61 file for the profiler.
+
+void io61_record_stats(const io61_stats& stats) {
+    std::lock_guard<std::mutex> guard(stats_mutex);
+    stats_list.push_back(stats);
+}
+
+
+namespace {
+
+// append_stats_json(out)
+//    Append recorded io61 counters to the JSON object in `out`, both per
+//    file (`"io61"`) and summed over all files (`"io61_syscalls"`, ...).
+
+void append_stats_json(std::string& out) {
+    std::lock_guard<std::mutex> guard(stats_mutex);
+    if (stats_list.empty()) {
+        return;
+    }
+    char buf[400];
+    io61_stats total;
+    out += ", \"io61\":[";
+    for (size_t i = 0; i != stats_list.size(); ++i) {
+        const io61_stats& st = stats_list[i];
+        snprintf(buf, sizeof(buf),
+            "%s{\"fd\":%d, \"mode\":\"%s\", \"syscalls\":%lu, \"bytes_read\":%lu, \"bytes_written\":%lu, \"hits\":%lu, \"misses\":%lu, \"fills\":%lu, \"flushes\":%lu, \"seeks\":%lu}",
+            i ? ", " : "", st.fd, st.mode == O_RDONLY ? "r" : "w",
+            st.syscalls, st.bytes_read, st.bytes_written, st.hits,
+            st.misses, st.fills, st.flushes, st.seeks);
+        out += buf;
+        total.syscalls += st.syscalls;
+        total.bytes_read += st.bytes_read;
+        total.bytes_written += st.bytes_written;
+        total.hits += st.hits;
+        total.misses += st.misses;
+        total.fills += st.fills;
+        total.flushes += st.flushes;
+        total.seeks += st.seeks;
+    }
+    snprintf(buf, sizeof(buf),
+        "], \"io61_syscalls\":%lu, \"io61_bytes_read\":%lu, \"io61_bytes_written\":%lu, \"io61_hits\":%lu, \"io61_misses\":%lu, \"io61_fills\":%lu, \"io61_flushes\":%lu, \"io61_seeks\":%lu",
+        total.syscalls, total.bytes_read, total.bytes_written, total.hits,
+        total.misses, total.fills, total.flushes, total.seeks);
+    out += buf;
+}
+
 struct io61_profiler {
     double begin_at;
     io61_profiler();
@@ -521,8 +607,8 @@ io61_profiler::~io61_profiler() {
 #endif
 
     char buf[2000];
-    ssize_t len = snprintf(buf, sizeof(buf),
-        "{\"time\":%.6f, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld, \"minflt\":%ld, \"majflt\":%ld, \"inblock\":%ld, \"oublock\":%ld}\n",
+    snprintf(buf, sizeof(buf),
+        "{\"time\":%.6f, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld, \"minflt\":%ld, \"majflt\":%ld, \"inblock\":%ld, \"oublock\":%ld",
         real_elapsed,
         usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
         usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
@@ -531,6 +617,9 @@ io61_profiler::~io61_profiler() {
         usage.ru_majflt + cusage.ru_majflt,
         usage.ru_inblock + cusage.ru_inblock,
         usage.ru_oublock + cusage.ru_oublock);
+    std::string json = buf;
+    append_stats_json(json);
+    json += "}\n";
 
     off_t off = lseek(100, 0, SEEK_CUR);
     int fd = (off != (off_t) -1 || errno == ESPIPE ? 100 : STDERR_FILENO);
@@ -539,8 +628,9 @@ io61_profiler::~io61_profiler() {
     } else if (fd == STDERR_FILENO) {
         fflush(stderr);
     }
+    ssize_t len = json.size();
     while (true) {
-        ssize_t nw = write(fd, buf, len);
+        ssize_t nw = write(fd, json.data(), len);
         if (nw == len) {
             break;
         }
@@ -3,30 +3,253 @@
 #include <sys/stat.h>
 #include <climits>
 #include <cerrno>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#if defined(__x86_64__)
+# include <immintrin.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# define IO61_HAVE_URING 1
+#else
+# define IO61_HAVE_URING 0
+#endif
+#ifndef IO61_HAVE_ZLIB   // set by the GNUmakefile when zlib is installed
+# define IO61_HAVE_ZLIB 0
+#endif
+#if IO61_HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 // io61.cc
-//    YOUR CODE HERE!
+//    Cached I/O for io61 files. Read-only files use a single-slot cache
+//    that can optionally be filled by a read-ahead helper thread; either
+//    kind of file can instead use an io_uring backend. Regular files can
+//    also bypass the kernel’s page cache with O_DIRECT, and streams can be
+//    gzip-compressed.
 
 
+struct io61_readahead;
+struct io61_uring;
+struct io61_gzip;
+
+// O_DIRECT alignment for buffers, offsets, and lengths
+static constexpr size_t io61_direct_align = 4096;
+
 // io61_file
-//    Data structure for io61 file wrappers. Add your own stuff.
+//    Data structure for io61 file wrappers.
 
-struct io61_file {
+struct io61_file : io61_fastbuf {   // `io61_fastbuf` must come first
     int fd = -1;     // file descriptor
     int mode;        // open mode (O_RDONLY or O_WRONLY)
+    int flags;       // io61 mode flags (IO61_READAHEAD, ...)
+    bool seekable;   // is this file seekable?
+
+    // Single-slot cache
+    off_t cbufsz = 8192;   // size of `cbuf`
+    bool sized = false;    // has `cbufsz` been matched to a pipe?
+    bool direct = false;   // is O_DIRECT set on `fd`?
+    unsigned char* cbuf;
+    off_t tag;       // offset of first character in `cbuf`
+    off_t pos_tag;   // next offset to read or write
+    off_t end_tag;   // offset one past last valid character in `cbuf`
+    bool dirty = false;    // has cache been written?
+
+    // Write coalescing: after a seek within the write cache, dirty data
+    // is `ranges`, a sorted list of disjoint [first, last) offset ranges,
+    // plus the current run [run_tag, end_tag)
+    bool scattered = false;
+    off_t run_tag;
+    std::vector<std::pair<off_t, off_t>> ranges;
+
+    // Auto-flush policy for written data (`io61_set_autoflush`)
+    int flush_policy = IO61_FLUSH_FULL;
+    double flush_deadline = 0;    // longest time data may stay cached
+    double dirty_at;              // when the cache became dirty
+    std::thread::id flush_owner;  // thread that set the policy
+
+    // Lines that straddle cache blocks (`io61_readline`)
+    std::vector<unsigned char> linebuf;
+
+    // Read-ahead state (IO61_READAHEAD)
+    io61_readahead* ra = nullptr;
+
+    // io_uring state (IO61_URING)
+    io61_uring* ur = nullptr;
+
+    // Compression state (IO61_GZIP)
+    io61_gzip* gz = nullptr;
+
+    // Counters reported to the profiler when `f` is closed
+    io61_stats stats;
+
+    // Start of the fast-path window when it was granted
+    unsigned char* fast_start;
+};
+
+static_assert(io61_fastbuf_first<io61_file>());
+
+
+// How `io61_gzip_deflate` ends a block of compressed output
+enum io61_gzip_end { io61_gzip_more, io61_gzip_sync, io61_gzip_finish };
+
+static int io61_env_flags(int mode);
+static void io61_readahead_start(io61_file* f);
+static void io61_readahead_stop(io61_file* f);
+static bool io61_uring_start(io61_file* f);
+static void io61_uring_stop(io61_file* f);
+static bool io61_direct_start(io61_file* f);
+static bool io61_gzip_start(io61_file* f);
+static void io61_gzip_stop(io61_file* f);
+static int io61_gzip_deflate(io61_file* f, io61_gzip_end end);
+static void io61_wait(io61_file* f, short events);
+static void io61_track_interactive(io61_file* f, bool interactive);
+static void io61_flush_interactive(io61_file* except, bool expired);
+static double io61_now();
+
+
+// io61_fast_sync(f), io61_fast_grant(f)
+//    `io61_fast_sync` folds bytes transferred through `f`’s inline window
+//    into `pos_tag` and closes the window. `io61_fast_grant` opens a new
+//    window onto the cached bytes `io61_readc_slow` or `io61_writec_slow`
+//    would use. Write windows are withheld under line and deadline flush
+//    policies, which must inspect each byte. Windows granted by nested
+//    calls may go stale, but they are never used before the outermost
+//    call grants a fresh one, and syncing an unused window changes nothing.
+
+static void io61_fast_sync(io61_file* f) {
+    if (f->rpos) {
+        off_t n = f->rpos - f->fast_start;
+        f->pos_tag += n;
+        f->stats.hits += n;
+        f->rpos = f->rend = nullptr;
+    } else if (f->wpos) {
+        off_t n = f->wpos - f->fast_start;
+        f->pos_tag += n;
+        f->end_tag += n;
+        f->stats.hits += n;
+        f->dirty = f->dirty || n != 0;
+        f->wpos = f->wend = nullptr;
+    }
+}
+
+static void io61_fast_grant(io61_file* f) {
+    f->rpos = f->rend = f->wpos = f->wend = nullptr;
+    if (f->mode == O_RDONLY) {
+        if (f->pos_tag < f->end_tag) {
+            f->rpos = f->cbuf + (f->pos_tag - f->tag);
+            f->rend = f->cbuf + (f->end_tag - f->tag);
+            f->fast_start = f->rpos;
+        }
+    } else if (f->flush_policy == IO61_FLUSH_FULL
+               && f->flush_deadline == 0
+               && f->pos_tag == f->end_tag
+               && f->end_tag < f->tag + f->cbufsz) {
+        f->wpos = f->cbuf + (f->pos_tag - f->tag);
+        f->wend = f->cbuf + f->cbufsz;
+        f->fast_start = f->wpos;
+    }
+}
+
+// io61_fast_guard
+//    Public functions hold one of these per file: it syncs the window on
+//    entry and grants a fresh one on return.
+
+struct io61_fast_guard {
+    io61_file* f;
+    explicit io61_fast_guard(io61_file* f_)
+        : f(f_) {
+        io61_fast_sync(f);
+    }
+    ~io61_fast_guard() {
+        io61_fast_grant(f);
+    }
 };
 
 
 // io61_fdopen(fd, mode)
 //    Returns a new io61_file for file descriptor `fd`. `mode` is either
-//    O_RDONLY for a read-only file or O_WRONLY for a write-only file.
+//    O_RDONLY for a read-only file or O_WRONLY for a write-only file,
+//    possibly combined with io61 mode flags like `IO61_READAHEAD`.
 //    You need not support read/write files.
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
     f->fd = fd;
-    f->mode = mode;
+    f->mode = mode & O_ACCMODE;
+    f->flags = (mode | io61_env_flags(f->mode)) & IO61_MODEMASK;
+    if (f->flags & IO61_GZIP) {
+        // zlib works on the plain cache
+        f->flags &= ~(IO61_URING | IO61_DIRECT);
+    }
+    if (f->flags & IO61_DIRECT) {
+        // O_DIRECT needs aligned buffers, which the other modes don’t use
+        f->flags &= ~(IO61_READAHEAD | IO61_URING);
+    }
+    if (f->mode != O_RDONLY || (f->flags & IO61_URING)) {
+        // io_uring reads ahead by itself
+        f->flags &= ~IO61_READAHEAD;
+    }
+    f->stats.fd = fd;
+    f->stats.mode = f->mode;
+    off_t off = lseek(fd, 0, SEEK_CUR);
+    ++f->stats.syscalls;
+    f->seekable = off != -1;
+    f->tag = f->pos_tag = f->end_tag = f->seekable ? off : 0;
+    if ((f->flags & IO61_GZIP) && !io61_gzip_start(f)) {
+        // Uncompressed input, or no zlib
+        f->flags &= ~IO61_GZIP;
+    } else if ((f->flags & IO61_GZIP) && f->mode == O_RDONLY) {
+        // The helper thread decompresses
+        f->flags |= IO61_READAHEAD;
+    }
+    if ((f->flags & IO61_URING) && !io61_uring_start(f)) {
+        // io_uring unavailable: fall back to system calls
+        f->flags &= ~IO61_URING;
+    }
+    if ((f->flags & IO61_DIRECT) && !io61_direct_start(f)) {
+        // O_DIRECT unsupported here: use the page cache
+        f->flags &= ~IO61_DIRECT;
+    }
+    if (f->flags & (IO61_READAHEAD | IO61_GZIP)) {
+        // Larger buffers amortize the cost of handing them between
+        // threads or to zlib
+        f->cbufsz = 65536;
+    }
+    if (f->flags & IO61_DIRECT) {
+        // Every transfer reaches the device, so make them large
+        f->cbufsz = 262144;
+        f->cbuf = (unsigned char*) aligned_alloc(io61_direct_align, f->cbufsz);
+    } else if (!f->ur) {
+        f->cbuf = new unsigned char[f->cbufsz];
+    }
+    // Only pipes are resized, and only the plain cache
+    f->sized = f->seekable || f->ur || f->gz
+        || (f->flags & IO61_READAHEAD);
+    if (f->flags & IO61_READAHEAD) {
+        io61_readahead_start(f);
+    }
+    if (f->mode != O_RDONLY && !f->seekable) {
+        // Like stdio, terminal output is line buffered. Pipe output stays
+        // fully buffered, also like stdio: flushing every line would
+        // multiply write system calls for bulk pipelines. Interactive
+        // pipe output is still flushed before io61 blocks reading, and
+        // `io61_set_autoflush` can ask for line or deadline flushing.
+        ++f->stats.syscalls;
+        if (isatty(fd)) {
+            io61_set_autoflush(f, IO61_FLUSH_LINE);
+        }
+    }
+    io61_fast_grant(f);
     return f;
 }
 
@@ -35,27 +258,56 @@ io61_file* io61_fdopen(int fd, int mode) {
 //    Closes the io61_file `f` and releases all its resources.
 
 int io61_close(io61_file* f) {
-    io61_flush(f);
+    io61_fast_sync(f);
+    if (f->gz && f->mode != O_RDONLY) {
+        // Compressed output ends with the gzip trailer
+        io61_gzip_deflate(f, io61_gzip_finish);
+    } else {
+        io61_flush(f);
+    }
+    io61_track_interactive(f, false);
+    if (f->ra) {
+        io61_readahead_stop(f);
+    }
+    if (f->gz) {
+        io61_gzip_stop(f);
+    }
+    if (f->ur) {
+        io61_uring_stop(f);
+    } else if (f->flags & IO61_DIRECT) {
+        free(f->cbuf);
+    } else {
+        delete[] f->cbuf;
+    }
     int r = close(f->fd);
+    ++f->stats.syscalls;
+    io61_record_stats(f->stats);
     delete f;
     return r;
 }
 
 
-// io61_readc(f)
+// io61_readc_slow(f)
 //    Reads a single (unsigned) byte from `f` and returns it. Returns EOF,
 //    which equals -1, on end of file or error.
 
-int io61_readc(io61_file* f) {
-    unsigned char ch;
-    ssize_t nr = read(f->fd, &ch, 1);
-    if (nr != 1) {
-        assert(nr == 0 || nr == -1);
-        if (nr == 0) {
+static int io61_fill(io61_file* f, bool wait = true);
+
+int io61_readc_slow(io61_file* f) {
+    io61_fast_guard guard(f);
+    if (f->pos_tag < f->end_tag) {
+        ++f->stats.hits;
+    } else {
+        ++f->stats.misses;
+        if (io61_fill(f) == -1) {
+            return -1;
+        } else if (f->pos_tag >= f->end_tag) {
             errno = 0; // clear `errno` to indicate EOF
+            return -1;
         }
-        return -1;
     }
+    unsigned char ch = f->cbuf[f->pos_tag - f->tag];
+    ++f->pos_tag;
     return ch;
 }
 
@@ -68,35 +320,183 @@ int io61_readc(io61_file* f) {
 //
 //    Note that the return value might be positive, but less than `sz`,
 //    if end-of-file or error is encountered before all `sz` bytes are read.
-//    This is called a “short read.”
+//    This is called a “short read.” On a nonblocking file, a short read
+//    also returns the data available so far rather than waiting for more.
 
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
+    io61_fast_guard guard(f);
+    if (f->pos_tag + off_t(sz) <= f->end_tag) {
+        ++f->stats.hits;
+    } else {
+        ++f->stats.misses;
+    }
     size_t nread = 0;
     while (nread != sz) {
-        int ch = io61_readc(f);
-        if (ch == EOF) {
+        if (f->pos_tag >= f->end_tag) {
+            // Large reads bypass the cache when nothing else fills it
+            if (!f->ra
+                && !f->ur
+                && !f->direct
+                && f->pos_tag == f->end_tag
+                && sz - nread >= size_t(f->cbufsz)) {
+                ssize_t nr = read(f->fd, &buf[nread], sz - nread);
+                ++f->stats.syscalls;
+                if (nr > 0) {
+                    f->stats.bytes_read += nr;
+                    nread += nr;
+                    f->tag = f->pos_tag = f->end_tag = f->end_tag + nr;
+                    continue;
+                } else if (nr == -1 && errno == EAGAIN && nread != 0) {
+                    break;
+                } else if (nr == -1 && errno == EAGAIN) {
+                    io61_wait(f, POLLIN);
+                    continue;
+                } else if (nr == -1 && errno == EINTR) {
+                    continue;
+                } else if (nr == -1 && nread == 0) {
+                    return -1;
+                }
+                break;
+            }
+            int r = io61_fill(f, nread == 0);
+            if (r == -1 && nread == 0) {
+                return -1;
+            } else if (r == -1 || f->pos_tag >= f->end_tag) {
+                break;
+            }
+        }
+        size_t ncopy = std::min(sz - nread, size_t(f->end_tag - f->pos_tag));
+        memcpy(&buf[nread], &f->cbuf[f->pos_tag - f->tag], ncopy);
+        nread += ncopy;
+        f->pos_tag += ncopy;
+    }
+    return nread;
+}
+
+
+// io61_readline(f, linep, sz)
+//    Reads the next line from `f`, including its terminating newline,
+//    but no more than `sz` bytes. Sets `*linep` to point to the line and
+//    returns its length. Returns 0 on end of file and -1 if an error is
+//    encountered before any bytes are read.
+//
+//    The line usually points into `f`’s cache; lines that straddle cache
+//    blocks are assembled in a separate buffer. Either way, `*linep`
+//    remains valid only until the next operation on `f`.
+
+static const unsigned char* io61_memnl(const unsigned char* s, size_t n);
+
+ssize_t io61_readline(io61_file* f, const unsigned char** linep, size_t sz) {
+    io61_fast_guard guard(f);
+    f->linebuf.clear();
+    bool filled = false;
+    while (f->linebuf.size() != sz) {
+        if (f->pos_tag >= f->end_tag) {
+            filled = true;
+            int r = io61_fill(f);
+            if (r == -1 && f->linebuf.empty()) {
+                return -1;
+            } else if (r == -1 || f->pos_tag >= f->end_tag) {
+                break;
+            }
+        }
+        const unsigned char* s = &f->cbuf[f->pos_tag - f->tag];
+        size_t n = std::min(sz - f->linebuf.size(),
+                            size_t(f->end_tag - f->pos_tag));
+        const unsigned char* nl = io61_memnl(s, n);
+        if (nl) {
+            n = nl + 1 - s;
+        }
+        f->pos_tag += n;
+        if (f->linebuf.empty() && (nl || n == sz)) {
+            // The whole line is cached
+            ++(filled ? f->stats.misses : f->stats.hits);
+            *linep = s;
+            return n;
+        }
+        f->linebuf.insert(f->linebuf.end(), s, s + n);
+        if (nl) {
             break;
         }
-        buf[nread] = ch;
-        ++nread;
     }
-    if (nread == 0 && sz != 0 && errno != 0) {
-        return -1;
+    ++f->stats.misses;
+    *linep = f->linebuf.data();
+    return f->linebuf.size();
+}
+
+
+// io61_memnl(s, n)
+//    Returns a pointer to the first newline in the `n` bytes at `s`, or
+//    nullptr if there is none. On x86-64, compares 32 (AVX2) or 16 (SSE2)
+//    bytes at a time.
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static const unsigned char* io61_memnl_avx2(const unsigned char* s, size_t n) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) &s[i]);
+        if (unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl))) {
+            return &s[i + __builtin_ctz(m)];
+        }
     }
-    return nread;
+    return (const unsigned char*) memchr(&s[i], '\n', n - i);
+}
+
+static const unsigned char* io61_memnl_sse2(const unsigned char* s, size_t n) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) &s[i]);
+        if (unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl))) {
+            return &s[i + __builtin_ctz(m)];
+        }
+    }
+    return (const unsigned char*) memchr(&s[i], '\n', n - i);
+}
+
+static const unsigned char* io61_memnl(const unsigned char* s, size_t n) {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2 ? io61_memnl_avx2(s, n) : io61_memnl_sse2(s, n);
 }
+#else
+static const unsigned char* io61_memnl(const unsigned char* s, size_t n) {
+    return (const unsigned char*) memchr(s, '\n', n);
+}
+#endif
 
 
-// io61_writec(f)
+// io61_writec_slow(f, c)
 //    Write a single character `c` to `f` (converted to unsigned char).
 //    Returns 0 on success and -1 on error.
 
-int io61_writec(io61_file* f, int c) {
-    unsigned char ch = c;
-    ssize_t nw = write(f->fd, &ch, 1);
-    if (nw != 1) {
-        assert(nw == 0 || nw == -1);
-        return -1;
+static int io61_spill(io61_file* f);
+
+int io61_writec_slow(io61_file* f, int c) {
+    io61_fast_guard guard(f);
+    if (f->end_tag != f->tag + f->cbufsz) {
+        ++f->stats.hits;
+    } else {
+        ++f->stats.misses;
+        if (io61_spill(f) == -1) {
+            return -1;
+        }
+    }
+    if (!f->dirty && f->flush_deadline > 0) {
+        f->dirty_at = io61_now();
+    }
+    f->cbuf[f->pos_tag - f->tag] = c;
+    ++f->pos_tag;
+    ++f->end_tag;
+    f->dirty = true;
+    if (f->flush_policy != IO61_FLUSH_FULL || f->flush_deadline > 0) {
+        // The clock is checked on every write, so a deadline is a bound
+        if ((f->flush_policy == IO61_FLUSH_LINE && c == '\n')
+            || (f->flush_deadline > 0
+                && io61_now() - f->dirty_at >= f->flush_deadline)) {
+            return io61_flush(f);
+        }
     }
     return 0;
 }
@@ -109,17 +509,268 @@ int io61_writec(io61_file* f, int c) {
 //    number of characters written, or -1 if no characters were written
 //    before the error occurred.
 
+static int io61_autoflush(io61_file* f, const unsigned char* buf, size_t sz);
+
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
+    io61_fast_guard guard(f);
+    if (f->pos_tag + off_t(sz) < f->tag + f->cbufsz) {
+        ++f->stats.hits;
+    } else {
+        ++f->stats.misses;
+    }
+    if (!f->dirty && f->flush_deadline > 0) {
+        f->dirty_at = io61_now();
+    }
     size_t nwritten = 0;
     while (nwritten != sz) {
-        if (io61_writec(f, buf[nwritten]) == -1) {
+        if (f->end_tag == f->tag + f->cbufsz) {
+            if (io61_spill(f) == -1) {
+                break;
+            }
+        }
+        // Large writes bypass an empty cache
+        if (!f->ur
+            && !f->direct
+            && !f->scattered
+            && !f->gz
+            && f->end_tag == f->tag
+            && sz - nwritten >= size_t(f->cbufsz)) {
+            ssize_t nw = write(f->fd, &buf[nwritten], sz - nwritten);
+            ++f->stats.syscalls;
+            if (nw > 0) {
+                f->stats.bytes_written += nw;
+                nwritten += nw;
+                f->tag = f->pos_tag = f->end_tag = f->end_tag + nw;
+                continue;
+            } else if (nw == -1 && errno == EAGAIN) {
+                io61_wait(f, POLLOUT);
+                continue;
+            } else if (nw == -1 && errno == EINTR) {
+                continue;
+            }
             break;
         }
-        ++nwritten;
+        size_t ncopy = std::min(sz - nwritten,
+                                size_t(f->tag + f->cbufsz - f->pos_tag));
+        memcpy(&f->cbuf[f->pos_tag - f->tag], &buf[nwritten], ncopy);
+        f->pos_tag += ncopy;
+        f->end_tag += ncopy;
+        f->dirty = true;
+        nwritten += ncopy;
+    }
+    if (nwritten == 0 && sz != 0) {
+        return -1;
+    }
+    if (f->flush_policy != IO61_FLUSH_FULL || f->flush_deadline > 0) {
+        io61_autoflush(f, buf, nwritten);
+    }
+    return nwritten;
+}
+
+
+// io61_readv(f, iov, iovcnt)
+//    Reads data from `f` into the `iovcnt` buffers described by `iov`,
+//    filling each in turn. Returns the total number of bytes read, with
+//    the same end-of-file and error conventions as `io61_read`.
+//
+//    Once the cache is empty, large requests are read directly into the
+//    caller’s buffers with a single `readv`, which also refills the cache.
+//    Like `io61_read`, returns early on a nonblocking file that has no
+//    more data available.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    io61_fast_guard guard(f);
+    size_t sz = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        sz += iov[i].iov_len;
+    }
+    if (f->pos_tag + off_t(sz) <= f->end_tag) {
+        ++f->stats.hits;
+    } else {
+        ++f->stats.misses;
+    }
+    size_t nread = 0;
+    int i = 0;          // current buffer
+    size_t ioff = 0;    // offset in current buffer
+    while (nread != sz) {
+        if (ioff == iov[i].iov_len) {
+            ++i;
+            ioff = 0;
+            continue;
+        }
+        if (f->pos_tag >= f->end_tag) {
+            if (!f->ra
+                && !f->ur
+                && !f->direct
+                && f->pos_tag == f->end_tag
+                && sz - nread >= size_t(f->cbufsz)) {
+                struct iovec v[IOV_MAX];
+                int nv = 0;
+                size_t nuser = 0;
+                for (int j = i; j != iovcnt && nv != IOV_MAX - 1; ++j) {
+                    size_t off = j == i ? ioff : 0;
+                    v[nv].iov_base = (unsigned char*) iov[j].iov_base + off;
+                    v[nv].iov_len = iov[j].iov_len - off;
+                    nuser += v[nv].iov_len;
+                    ++nv;
+                }
+                v[nv].iov_base = f->cbuf;
+                v[nv].iov_len = f->cbufsz;
+                ++nv;
+                ssize_t nr = readv(f->fd, v, nv);
+                ++f->stats.syscalls;
+                if (nr > 0) {
+                    f->stats.bytes_read += nr;
+                    // Data past the caller’s buffers lands in the cache
+                    size_t n = std::min(size_t(nr), nuser);
+                    nread += n;
+                    f->tag = f->pos_tag = f->end_tag + n;
+                    f->end_tag += nr;
+                    while (n != 0) {
+                        size_t k = std::min(n, iov[i].iov_len - ioff);
+                        ioff += k;
+                        n -= k;
+                        if (ioff == iov[i].iov_len && n != 0) {
+                            ++i;
+                            ioff = 0;
+                        }
+                    }
+                    continue;
+                } else if (nr == -1 && errno == EAGAIN && nread != 0) {
+                    break;
+                } else if (nr == -1 && errno == EAGAIN) {
+                    io61_wait(f, POLLIN);
+                    continue;
+                } else if (nr == -1 && errno == EINTR) {
+                    continue;
+                } else if (nr == -1 && nread == 0) {
+                    return -1;
+                }
+                break;
+            }
+            int r = io61_fill(f, nread == 0);
+            if (r == -1 && nread == 0) {
+                return -1;
+            } else if (r == -1 || f->pos_tag >= f->end_tag) {
+                break;
+            }
+        }
+        size_t ncopy = std::min(iov[i].iov_len - ioff,
+                                size_t(f->end_tag - f->pos_tag));
+        memcpy((unsigned char*) iov[i].iov_base + ioff,
+               &f->cbuf[f->pos_tag - f->tag], ncopy);
+        ioff += ncopy;
+        nread += ncopy;
+        f->pos_tag += ncopy;
+    }
+    return nread;
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Writes the `iovcnt` buffers described by `iov` to `f`, in order.
+//    Returns the total number of bytes written, with the same error
+//    conventions as `io61_write`.
+//
+//    Requests that fit in the cache are copied there. Larger requests are
+//    written together with any cached data using a single `writev`.
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    io61_fast_guard guard(f);
+    size_t sz = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        sz += iov[i].iov_len;
+    }
+    if (!f->dirty && f->flush_deadline > 0) {
+        f->dirty_at = io61_now();
+    }
+    size_t nwritten = 0;
+    if (sz <= size_t(f->tag + f->cbufsz - f->pos_tag)) {
+        // Everything fits in the cache
+        ++f->stats.hits;
+        for (int i = 0; i != iovcnt; ++i) {
+            memcpy(&f->cbuf[f->pos_tag - f->tag], iov[i].iov_base,
+                   iov[i].iov_len);
+            f->pos_tag += iov[i].iov_len;
+        }
+        f->end_tag = f->pos_tag;
+        f->dirty = f->dirty || sz != 0;
+        nwritten = sz;
+    } else if (f->ur || f->direct || f->scattered || f->gz
+               || sz < size_t(f->cbufsz)) {
+        for (int i = 0; i != iovcnt; ++i) {
+            ssize_t nw = io61_write(f, (const unsigned char*) iov[i].iov_base,
+                                    iov[i].iov_len);
+            if (nw > 0) {
+                nwritten += nw;
+            }
+            if (nw != ssize_t(iov[i].iov_len)) {
+                break;
+            }
+        }
+    } else {
+        ++f->stats.misses;
+        int i = 0;          // current buffer
+        size_t ioff = 0;    // offset in current buffer
+        while (nwritten != sz) {
+            // Gather cached data and the caller’s remaining buffers
+            struct iovec v[IOV_MAX];
+            int nv = 0;
+            size_t ncached = f->end_tag - f->tag;
+            if (ncached != 0) {
+                v[nv].iov_base = f->cbuf;
+                v[nv].iov_len = ncached;
+                ++nv;
+            }
+            for (int j = i; j != iovcnt && nv != IOV_MAX; ++j) {
+                size_t off = j == i ? ioff : 0;
+                v[nv].iov_base = (unsigned char*) iov[j].iov_base + off;
+                v[nv].iov_len = iov[j].iov_len - off;
+                ++nv;
+            }
+            ssize_t nw = writev(f->fd, v, nv);
+            ++f->stats.syscalls;
+            if (nw > 0) {
+                f->stats.bytes_written += nw;
+            }
+            if (nw == -1 && errno == EAGAIN) {
+                io61_wait(f, POLLOUT);
+                continue;
+            } else if (nw == -1 && errno == EINTR) {
+                continue;
+            } else if (nw <= 0) {
+                break;
+            }
+            // Cached data was written first
+            size_t n = std::min(size_t(nw), ncached);
+            memmove(&f->cbuf[0], &f->cbuf[n], ncached - n);
+            f->tag += n;
+            n = nw - n;
+            if (n != 0) {
+                nwritten += n;
+                f->tag = f->pos_tag = f->end_tag = f->end_tag + n;
+            }
+            while (n != 0) {
+                size_t k = std::min(n, iov[i].iov_len - ioff);
+                ioff += k;
+                n -= k;
+                if (ioff == iov[i].iov_len) {
+                    ++i;
+                    ioff = 0;
+                }
+            }
+        }
+        f->dirty = f->end_tag != f->tag;
     }
     if (nwritten == 0 && sz != 0) {
         return -1;
     }
+    if (f->flush_policy != IO61_FLUSH_FULL || f->flush_deadline > 0) {
+        for (int i = 0; i != iovcnt && f->dirty; ++i) {
+            io61_autoflush(f, (const unsigned char*) iov[i].iov_base,
+                           iov[i].iov_len);
+        }
+    }
     return nwritten;
 }
 
@@ -132,64 +783,1951 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 //    If `f` was opened read-only, `io61_flush(f)` returns 0. It may also
 //    drop any data cached for reading.
 
+static int io61_uring_flush(io61_file* f);
+static int io61_direct_flush(io61_file* f);
+static int io61_flush_ranges(io61_file* f);
+
 int io61_flush(io61_file* f) {
-    (void) f;
+    io61_fast_guard guard(f);
+    if (f->scattered) {
+        return io61_flush_ranges(f);
+    } else if (f->gz && f->mode != O_RDONLY) {
+        // Make everything written so far decompressible
+        return io61_gzip_deflate(f, io61_gzip_sync);
+    } else if (!f->dirty) {
+        return 0;
+    }
+    ++f->stats.flushes;
+    if (f->ur) {
+        return io61_uring_flush(f);
+    } else if (f->direct) {
+        return io61_direct_flush(f);
+    }
+    // Write cached data; the file position equals `f->tag`
+    while (f->tag != f->end_tag) {
+        ssize_t nw = write(f->fd, &f->cbuf[0], f->end_tag - f->tag);
+        ++f->stats.syscalls;
+        if (nw > 0) {
+            f->stats.bytes_written += nw;
+            memmove(&f->cbuf[0], &f->cbuf[nw], f->end_tag - f->tag - nw);
+            f->tag += nw;
+        } else if (nw == -1 && errno == EAGAIN) {
+            io61_wait(f, POLLOUT);
+        } else if (nw == -1 && errno != EINTR) {
+            return -1;
+        }
+    }
+    f->dirty = false;
     return 0;
 }
 
 
+// io61_note_run(f)
+//    Add `f`’s current run of written data to its dirty ranges, merging
+//    it with any ranges it overlaps or touches.
+
+static void io61_note_run(io61_file* f) {
+    off_t first = f->scattered ? f->run_tag : f->tag;
+    off_t last = f->end_tag;
+    if (first == last) {
+        return;
+    }
+    auto& r = f->ranges;
+    auto it = std::lower_bound(r.begin(), r.end(), first,
+        [] (const std::pair<off_t, off_t>& range, off_t off) {
+            return range.second < off;
+        });
+    auto merge_end = it;
+    while (merge_end != r.end() && merge_end->first <= last) {
+        first = std::min(first, merge_end->first);
+        last = std::max(last, merge_end->second);
+        ++merge_end;
+    }
+    it = r.erase(it, merge_end);
+    r.insert(it, {first, last});
+}
+
+
+// io61_flush_ranges(f)
+//    Flush a write cache holding scattered dirty ranges. Each merged range
+//    takes one `pwrite`, so nearby and reversed writes coalesce. Afterward
+//    the cache is empty at `f->pos_tag`, as is the file position.
+
+static int io61_flush_ranges(io61_file* f) {
+    io61_note_run(f);
+    if (!f->ranges.empty()) {
+        ++f->stats.flushes;
+    }
+    for (auto& range : f->ranges) {
+        while (range.first != range.second) {
+            ssize_t nw = pwrite(f->fd, &f->cbuf[range.first - f->tag],
+                                range.second - range.first, range.first);
+            ++f->stats.syscalls;
+            if (nw > 0) {
+                f->stats.bytes_written += nw;
+                range.first += nw;
+            } else if (nw == -1 && errno != EINTR) {
+                // Keep the unwritten ranges for a later flush
+                f->ranges.erase(f->ranges.begin(), f->ranges.begin()
+                                + (&range - f->ranges.data()));
+                f->run_tag = f->end_tag = f->pos_tag;
+                return -1;
+            }
+        }
+    }
+    f->ranges.clear();
+    f->scattered = false;
+    f->dirty = false;
+    f->tag = f->end_tag = f->pos_tag;
+    ++f->stats.syscalls;
+    if (lseek(f->fd, f->pos_tag, SEEK_SET) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_spill(f)
+//    Make room in `f`’s full write cache. The io_uring backend queues the
+//    cached block and continues in a fresh buffer; otherwise this is
+//    `io61_flush`, unless a pipe’s cache can first grow to the pipe size.
+//    Compressed output is deflated without forcing zlib to emit it all.
+
+static int io61_uring_queue(io61_file* f);
+static void io61_size_cache(io61_file* f);
+
+static int io61_spill(io61_file* f) {
+    if (f->ur) {
+        return io61_uring_queue(f);
+    } else if (f->gz) {
+        return io61_gzip_deflate(f, io61_gzip_more);
+    }
+    if (!f->sized) {
+        io61_size_cache(f);
+        if (f->end_tag != f->tag + f->cbufsz) {
+            return 0;
+        }
+    }
+    return io61_flush(f);
+}
+
+
+// io61_set_autoflush(f, policy, deadline)
+//    Sets when `f`’s cached output is flushed without an explicit
+//    `io61_flush`. `IO61_FLUSH_FULL` flushes only when the cache fills;
+//    `IO61_FLUSH_LINE` also flushes after writes that contain a newline.
+//    If `deadline` is positive, cached data is also flushed once it has
+//    waited `deadline` seconds; this is checked on every write to `f` and
+//    whenever the calling thread is about to block on another io61 file.
+//    Output with either option is also flushed before that thread blocks
+//    reading a pipe or terminal, so prompts reach the reader. Returns 0
+//    on success and -1 (with `errno` set to EINVAL) if `f` is read-only.
+
+int io61_set_autoflush(io61_file* f, int policy, double deadline) {
+    io61_fast_guard guard(f);
+    if (f->mode == O_RDONLY
+        || (policy != IO61_FLUSH_FULL && policy != IO61_FLUSH_LINE)
+        || deadline < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    f->flush_policy = policy;
+    f->flush_deadline = deadline;
+    f->dirty_at = io61_now();
+    f->flush_owner = std::this_thread::get_id();
+    io61_track_interactive(f, policy != IO61_FLUSH_FULL || deadline > 0);
+    return 0;
+}
+
+
+// io61_autoflush(f, buf, sz)
+//    Apply `f`’s flush policy after `sz` bytes from `buf` were written.
+
+static int io61_autoflush(io61_file* f, const unsigned char* buf, size_t sz) {
+    if (!f->dirty) {
+        return 0;
+    } else if ((f->flush_policy == IO61_FLUSH_LINE && io61_memnl(buf, sz))
+               || (f->flush_deadline > 0
+                   && io61_now() - f->dirty_at >= f->flush_deadline)) {
+        return io61_flush(f);
+    }
+    return 0;
+}
+
+
+// io61_track_interactive(f, interactive)
+// io61_flush_interactive(except, expired)
+//    Output files with a line or deadline policy are kept in a list.
+//    `io61_flush_interactive` flushes the listed files, other than
+//    `except`, whose policy was set by the calling thread; if `expired`
+//    is true, it flushes only those whose deadline has passed. io61
+//    files have no per-file lock, so other threads’ files are left
+//    alone. The list is copied under `interactive_mutex` and flushed
+//    after the mutex is released: a flush may wait on a full pipe, and
+//    `io61_wait` calls back here. Those nested calls return immediately.
+
+static std::mutex interactive_mutex;
+static std::vector<io61_file*> interactive_files;
+static std::atomic<size_t> ninteractive;    // `interactive_files.size()`
+
+static void io61_track_interactive(io61_file* f, bool interactive) {
+    std::lock_guard<std::mutex> guard(interactive_mutex);
+    auto it = std::find(interactive_files.begin(), interactive_files.end(), f);
+    if (interactive && it == interactive_files.end()) {
+        interactive_files.push_back(f);
+    } else if (!interactive && it != interactive_files.end()) {
+        interactive_files.erase(it);
+    }
+    ninteractive = interactive_files.size();
+}
+
+static void io61_flush_interactive(io61_file* except, bool expired) {
+    static thread_local bool flushing = false;
+    static thread_local std::vector<io61_file*> mine;
+    if (flushing || ninteractive == 0) {
+        return;
+    }
+    flushing = true;
+    {
+        std::lock_guard<std::mutex> guard(interactive_mutex);
+        std::thread::id self = std::this_thread::get_id();
+        for (io61_file* f : interactive_files) {
+            if (f != except && f->flush_owner == self) {
+                mine.push_back(f);
+            }
+        }
+    }
+    double now = expired ? io61_now() : 0;
+    for (io61_file* f : mine) {
+        if (!expired
+            || (f->dirty
+                && f->flush_deadline > 0
+                && now - f->dirty_at >= f->flush_deadline)) {
+            io61_flush(f);
+        }
+    }
+    mine.clear();
+    flushing = false;
+}
+
+
+// io61_now()
+//    Returns the current monotonic time in seconds.
+
+static double io61_now() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
 // io61_seek(f, off)
 //    Changes the file pointer for file `f` to `off` bytes into the file.
 //    Returns 0 on success and -1 on failure.
 
+static void io61_readahead_reset(io61_file* f, off_t off);
+static void io61_direct_stop(io61_file* f);
+
 int io61_seek(io61_file* f, off_t off) {
-    off_t r = lseek(f->fd, (off_t) off, SEEK_SET);
-    // Ignore the returned offset unless it’s an error.
-    if (r == -1) {
+    io61_fast_guard guard(f);
+    ++f->stats.seeks;
+    if (f->mode == O_RDONLY && off >= f->tag && off <= f->end_tag) {
+        // Seek within cached data
+        ++f->stats.hits;
+        f->pos_tag = off;
+        return 0;
+    } else if (f->mode != O_RDONLY && off == f->pos_tag) {
+        ++f->stats.hits;
+        return 0;
+    }
+    // Writes may coalesce in a seekable system-call cache
+    bool coalesce = f->mode != O_RDONLY && f->seekable
+        && !f->ur && !f->direct;
+    if (coalesce && off >= f->tag && off < f->tag + f->cbufsz) {
+        // Seek within the write cache: remember the run written so far
+        ++f->stats.hits;
+        io61_note_run(f);
+        f->scattered = true;
+        f->run_tag = f->pos_tag = f->end_tag = off;
+        return 0;
+    }
+    ++f->stats.misses;
+    if (!f->seekable) {
+        errno = ESPIPE;
+        return -1;
+    } else if (io61_flush(f) == -1) {
         return -1;
     }
+
+    // Read-only files align the cache so that reverse and strided access
+    // patterns can reuse cached data
+    off_t aligned = off;
+    if (f->mode == O_RDONLY) {
+        aligned = off - off % f->cbufsz;
+    } else if (coalesce && off < f->pos_tag) {
+        // Writes moving backward, as in `wreverse61`, get a cache that
+        // ends just after `off`; `io61_flush_ranges` sets the file position
+        f->tag = std::max(off - f->cbufsz + 1, off_t(0));
+        f->scattered = true;
+        f->run_tag = f->pos_tag = f->end_tag = off;
+        return 0;
+    }
+    if (f->direct && f->mode != O_RDONLY && off % io61_direct_align != 0) {
+        // Writes must start at aligned offsets, but we can’t read the
+        // data that precedes `off` in its block
+        io61_direct_stop(f);
+    }
+    if (f->ra) {
+        io61_readahead_reset(f, aligned);
+    } else if (f->ur) {
+        // io_uring requests carry their own file offsets
+    } else {
+        ++f->stats.syscalls;
+        if (lseek(f->fd, aligned, SEEK_SET) == -1) {
+            return -1;
+        }
+    }
+    f->tag = f->end_tag = aligned;
+    f->pos_tag = off;
     return 0;
 }
 
 
-// You shouldn't need to change these functions.
+// io61_copy(in, out, n)
+//    Copies up to `n` bytes from `in`, starting at its file position, to
+//    `out`. Returns the number of bytes copied, which is less than `n`
+//    only on end of file or error. Returns 0 if end-of-file is encountered
+//    before any bytes are copied, and -1 if an error is encountered before
+//    any bytes are copied.
+//
+//    Large copies move data inside the kernel, using `copy_file_range`,
+//    `sendfile`, or `splice`, once `in`’s cached data is written. Other
+//    copies write directly from `in`’s cache.
 
-// io61_open_check(filename, mode)
-//    Opens the file corresponding to `filename` and returns its io61_file.
-//    If `!filename`, returns either the standard input or the
-//    standard output, depending on `mode`. Exits with an error message if
-//    `filename != nullptr` and the named file cannot be opened.
+static ssize_t io61_copy_kernel(io61_file* in, io61_file* out, size_t n,
+                                bool& fallback);
 
-io61_file* io61_open_check(const char* filename, int mode) {
-    int fd;
-    if (filename) {
-        fd = open(filename, mode, 0666);
-    } else if ((mode & O_ACCMODE) == O_RDONLY) {
-        fd = STDIN_FILENO;
+ssize_t io61_copy(io61_file* in, io61_file* out, size_t n) {
+    io61_fast_guard in_guard(in), out_guard(out);
+    assert(in->mode == O_RDONLY && out->mode != O_RDONLY);
+    // The kernel methods rely on the file positions, which the helper
+    // thread and io_uring don’t maintain, and can’t compress
+    bool kernel = !in->ra && !in->ur && !out->ur && !in->direct && !out->direct
+        && !out->gz;
+    size_t ncopied = 0;
+    while (ncopied != n) {
+        if (in->pos_tag >= in->end_tag) {
+            if (kernel && n - ncopied >= size_t(in->cbufsz)) {
+                ssize_t nk = io61_copy_kernel(in, out, n - ncopied, kernel);
+                if (nk > 0) {
+                    ncopied += nk;
+                    continue;
+                } else if (nk == 0 && kernel) {
+                    break;
+                } else if (nk == -1 && ncopied == 0) {
+                    return -1;
+                } else if (nk == -1) {
+                    break;
+                }
+            }
+            int r = io61_fill(in);
+            if (r == -1 && ncopied == 0) {
+                return -1;
+            } else if (r == -1 || in->pos_tag >= in->end_tag) {
+                break;
+            }
+        }
+        size_t ncopy = std::min(n - ncopied, size_t(in->end_tag - in->pos_tag));
+        ssize_t nw = io61_write(out, &in->cbuf[in->pos_tag - in->tag], ncopy);
+        if (nw > 0) {
+            in->pos_tag += nw;
+            ncopied += nw;
+        }
+        if (nw != ssize_t(ncopy)) {
+            if (ncopied == 0) {
+                return -1;
+            }
+            break;
+        }
+    }
+    return ncopied;
+}
+
+
+// io61_copy_kernel(in, out, n, fallback)
+//    Copies up to `n` bytes from `in` to `out` without passing them
+//    through user memory. `in`’s cache must be empty. If no kernel method
+//    works for these files, sets `fallback` to false and returns 0.
+
+static ssize_t io61_copy_kernel(io61_file* in, io61_file* out, size_t n,
+                                bool& fallback) {
+    // Synchronize the file positions with the io61 positions
+    if (in->pos_tag != in->end_tag) {
+        ++in->stats.syscalls;
+        if (lseek(in->fd, in->pos_tag, SEEK_SET) == -1) {
+            return -1;
+        }
+    }
+    in->tag = in->end_tag = in->pos_tag;
+    if (io61_flush(out) == -1) {
+        return -1;
+    }
+
+    struct stat ins, outs;
+    in->stats.syscalls += 2;
+    if (fstat(in->fd, &ins) == -1 || fstat(out->fd, &outs) == -1) {
+        return -1;
+    }
+    enum { m_copy_file_range, m_sendfile, m_splice, m_splice_pipe, m_none };
+    int method;
+    if (S_ISREG(ins.st_mode) && S_ISREG(outs.st_mode)) {
+        method = m_copy_file_range;
+    } else if (S_ISREG(ins.st_mode)) {
+        method = m_sendfile;
+    } else if (S_ISFIFO(ins.st_mode) || S_ISFIFO(outs.st_mode)) {
+        method = m_splice;
+    } else if (S_ISSOCK(ins.st_mode)) {
+        // `splice` needs a pipe on one side, so use a temporary one
+        method = m_splice_pipe;
     } else {
-        fd = STDOUT_FILENO;
+        method = m_none;
     }
-    if (fd < 0) {
-        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
-        exit(1);
+
+    int pfd[2] = {-1, -1};
+    size_t ncopied = 0;
+    bool error = false;
+    while (ncopied != n && method != m_none && !error) {
+        size_t chunk = std::min(n - ncopied, size_t(1) << 30);
+        ssize_t r;
+        ++in->stats.syscalls;
+        if (method == m_copy_file_range) {
+            r = copy_file_range(in->fd, nullptr, out->fd, nullptr, chunk, 0);
+        } else if (method == m_sendfile) {
+            r = sendfile(out->fd, in->fd, nullptr, chunk);
+        } else if (method == m_splice) {
+            r = splice(in->fd, nullptr, out->fd, nullptr, chunk, SPLICE_F_MOVE);
+        } else if (pfd[0] < 0 && pipe(pfd) == -1) {
+            r = -1;
+        } else {
+            r = splice(in->fd, nullptr, pfd[1], nullptr, chunk, SPLICE_F_MOVE);
+            // Empty the pipe before continuing; its data has left `in`
+            for (ssize_t ndrained = 0; r > 0 && ndrained != r; ) {
+                ssize_t d = splice(pfd[0], nullptr, out->fd, nullptr,
+                                   r - ndrained, SPLICE_F_MOVE);
+                ++out->stats.syscalls;
+                if (d > 0) {
+                    ndrained += d;
+                } else if (d == -1 && errno == EAGAIN) {
+                    io61_wait(out, POLLOUT);
+                } else if (d == 0 || errno != EINTR) {
+                    r = ndrained;
+                    error = true;
+                }
+            }
+        }
+
+        if (r > 0) {
+            ncopied += r;
+        } else if (r == 0) {
+            break;
+        } else if (errno == EAGAIN) {
+            // Either side may be nonblocking; both must become ready
+            io61_wait(in, POLLIN);
+            io61_wait(out, POLLOUT);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (ncopied == 0
+                   && (errno == EXDEV || errno == EINVAL || errno == ENOSYS
+                       || errno == EOPNOTSUPP || errno == EBADF)) {
+            // This method doesn’t support these files; try the next
+            if (method == m_copy_file_range) {
+                method = m_sendfile;
+            } else if (method == m_sendfile
+                       && (S_ISFIFO(ins.st_mode) || S_ISFIFO(outs.st_mode))) {
+                method = m_splice;
+            } else {
+                method = m_none;
+            }
+        } else {
+            error = true;
+        }
+    }
+    if (pfd[0] >= 0) {
+        close(pfd[0]);
+        close(pfd[1]);
+    }
+    if (method == m_none && ncopied == 0) {
+        fallback = false;
+        return 0;
+    } else if (error && ncopied == 0) {
+        return -1;
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+
+    in->tag = in->pos_tag = in->end_tag = in->end_tag + ncopied;
+    out->tag = out->pos_tag = out->end_tag = out->end_tag + ncopied;
+    in->stats.bytes_read += ncopied;
+    out->stats.bytes_written += ncopied;
+    return ncopied;
 }
 
 
-// io61_fileno(f)
-//    Returns the file descriptor associated with `f`.
+// io61_copy_parallel(in, out, n, nthreads)
+//    Like `io61_copy`, but copies large ranges between regular files with
+//    `nthreads` worker threads. The range is split into chunks that the
+//    workers claim in turn and copy with `pread` and `pwrite` at matching
+//    offsets, so several requests are in flight at once. Other files, and
+//    small copies, use `io61_copy`.
 
-int io61_fileno(io61_file* f) {
-    return f->fd;
+static ssize_t io61_copy_workers(io61_file* in, io61_file* out, size_t n,
+                                 int nthreads);
+
+ssize_t io61_copy_parallel(io61_file* in, io61_file* out, size_t n,
+                           int nthreads) {
+    io61_fast_guard in_guard(in), out_guard(out);
+    // Copy cached input first, leaving the cache empty
+    size_t ncached = std::min(n, size_t(std::max(in->end_tag - in->pos_tag,
+                                                 off_t(0))));
+    ssize_t nc = io61_copy(in, out, ncached);
+    if (nc != ssize_t(ncached) || n == ncached) {
+        return nc;
+    }
+    ssize_t nw = io61_copy_workers(in, out, n - ncached, nthreads);
+    if (nw == -1) {
+        return nc == 0 ? -1 : nc;
+    }
+    return nc + nw;
 }
 
 
-// io61_filesize(f)
-//    Returns the size of `f` in bytes. Returns -1 if `f` does not have a
-//    well-defined size (for instance, if it is a pipe).
+namespace {
+struct io61_copy_state {
+    static constexpr size_t chunksz = 1 << 20;
 
-off_t io61_filesize(io61_file* f) {
+    int infd;
+    int outfd;
+    off_t in_off;            // input offset of byte 0
+    off_t out_off;           // output offset of byte 0
+    size_t n;                // bytes to copy
+    std::atomic<size_t> next = 0;   // next chunk to claim
+
+    std::mutex m;
+    size_t ncopied;          // length of the copied prefix
+    int err = 0;             // error that ended the copy, if any
+    unsigned long nsyscalls = 0;
+};
+}
+
+static void io61_copy_worker(io61_copy_state* cs) {
+    unsigned char* buf = new unsigned char[cs->chunksz];
+    unsigned long nsyscalls = 0;
+    size_t c;
+    while ((c = cs->next++) * cs->chunksz < cs->n) {
+        size_t pos = c * cs->chunksz;
+        size_t end = std::min(pos + cs->chunksz, cs->n);
+        size_t nbuf = 0, nw = 0;
+        int err = 0;
+        while (pos != end) {
+            ssize_t r;
+            if (nw == nbuf) {
+                r = pread(cs->infd, buf, end - pos, cs->in_off + pos);
+                if (r > 0) {
+                    nbuf = r;
+                    nw = 0;
+                }
+            } else {
+                r = pwrite(cs->outfd, &buf[nw], nbuf - nw, cs->out_off + pos);
+                if (r > 0) {
+                    nw += r;
+                    pos += r;
+                }
+            }
+            ++nsyscalls;
+            if (r == 0 || (r == -1 && errno != EINTR)) {
+                // End of file or error: the copy ends at `pos`
+                err = r == 0 ? 0 : errno;
+                break;
+            }
+        }
+        if (pos != end) {
+            std::lock_guard<std::mutex> guard(cs->m);
+            if (pos < cs->ncopied) {
+                cs->ncopied = pos;
+                cs->err = err;
+            }
+        }
+    }
+    delete[] buf;
+    std::lock_guard<std::mutex> guard(cs->m);
+    cs->nsyscalls += nsyscalls;
+}
+
+static ssize_t io61_copy_workers(io61_file* in, io61_file* out, size_t n,
+                                 int nthreads) {
+    // Workers need positional I/O on regular files, and enough data
+    // to share
+    struct stat ins, outs;
+    in->stats.syscalls += 2;
+    if (nthreads <= 1
+        || in->ra || in->ur || out->ur || in->direct || out->direct || out->gz
+        || fstat(in->fd, &ins) == -1 || fstat(out->fd, &outs) == -1
+        || !S_ISREG(ins.st_mode) || !S_ISREG(outs.st_mode)
+        || in->pos_tag >= ins.st_size) {
+        return io61_copy(in, out, n);
+    }
+    n = std::min(n, size_t(ins.st_size - in->pos_tag));
+    size_t nchunks = (n + io61_copy_state::chunksz - 1) / io61_copy_state::chunksz;
+    if (nchunks < 2) {
+        return io61_copy(in, out, n);
+    } else if (io61_flush(out) == -1) {
+        return -1;
+    }
+
+    io61_copy_state cs;
+    cs.infd = in->fd;
+    cs.outfd = out->fd;
+    cs.in_off = in->pos_tag;
+    cs.out_off = out->pos_tag;
+    cs.n = cs.ncopied = n;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i != std::min(size_t(nthreads), nchunks); ++i) {
+        workers.emplace_back(io61_copy_worker, &cs);
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    // Leave the file positions after the copied data
+    in->tag = in->pos_tag = in->end_tag = cs.in_off + cs.ncopied;
+    out->tag = out->pos_tag = out->end_tag = cs.out_off + cs.ncopied;
+    in->stats.syscalls += cs.nsyscalls + 1;
+    in->stats.bytes_read += cs.ncopied;
+    ++out->stats.syscalls;
+    out->stats.bytes_written += cs.ncopied;
+    if (lseek(in->fd, in->end_tag, SEEK_SET) == -1
+        || lseek(out->fd, out->end_tag, SEEK_SET) == -1) {
+        return -1;
+    } else if (cs.ncopied == 0 && cs.err != 0) {
+        errno = cs.err;
+        return -1;
+    }
+    return cs.ncopied;
+}
+
+
+// io61_fill(f, wait)
+//    Fill the read cache with the data following `f->end_tag`. Returns 0
+//    on success (including end of file) and -1 on error. Without
+//    read-ahead or io_uring, the file position equals `f->end_tag`.
+//
+//    If a nonblocking file has no data available, waits for some, or, if
+//    `wait` is false, returns -1 with `errno` set to EAGAIN.
+
+static int io61_readahead_fill(io61_file* f);
+static int io61_uring_fill(io61_file* f);
+static int io61_direct_fill(io61_file* f);
+
+static int io61_fill(io61_file* f, bool wait) {
+    assert(f->mode == O_RDONLY);
+    ++f->stats.fills;
+    if (!f->seekable && ninteractive != 0) {
+        // The reader may be waiting for our output
+        io61_flush_interactive(nullptr, false);
+    }
+    if (f->ra) {
+        return io61_readahead_fill(f);
+    } else if (f->ur) {
+        return io61_uring_fill(f);
+    } else if (f->direct) {
+        return io61_direct_fill(f);
+    } else if (!f->sized) {
+        io61_size_cache(f);
+    }
+    f->tag = f->end_tag;
+    while (true) {
+        ssize_t nr = read(f->fd, f->cbuf, f->cbufsz);
+        ++f->stats.syscalls;
+        if (nr >= 0) {
+            f->stats.bytes_read += nr;
+            f->end_tag += nr;
+            return 0;
+        } else if (errno == EAGAIN && !wait) {
+            return -1;
+        } else if (errno == EAGAIN) {
+            io61_wait(f, POLLIN);
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+
+// io61_size_cache(f)
+//    Match the cache of a pipe to the pipe’s capacity, which the `-P`
+//    option or the other end may have changed since `f` was opened, so
+//    each system call can move a full pipe’s worth of data. Cached data
+//    is preserved.
+
+static void io61_size_cache(io61_file* f) {
+    f->sized = true;
+#ifdef F_GETPIPE_SZ
+    int psz = fcntl(f->fd, F_GETPIPE_SZ);
+    ++f->stats.syscalls;
+    if (psz > 0) {
+        off_t sz = std::min(std::max(off_t(psz), f->cbufsz), off_t(1) << 20);
+        if (sz != f->cbufsz) {
+            unsigned char* cbuf = new unsigned char[sz];
+            memcpy(cbuf, f->cbuf, f->end_tag - f->tag);
+            delete[] f->cbuf;
+            f->cbuf = cbuf;
+            f->cbufsz = sz;
+        }
+    }
+#endif
+}
+
+
+// io61_wait(f, events)
+//    Wait until `f`’s file descriptor is ready for `events` (POLLIN or
+//    POLLOUT). Used after a nonblocking file returns EAGAIN, so that
+//    io61 sleeps rather than spinning on the system call.
+
+static void io61_wait(io61_file* f, short events) {
+    io61_flush_interactive(f, true);
+    struct pollfd pfd = {f->fd, events, 0};
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR) {
+        ++f->stats.syscalls;
+    }
+    ++f->stats.syscalls;
+}
+
+
+
+// DIRECT I/O
+//    With IO61_DIRECT, regular files are accessed with O_DIRECT, so data
+//    moves between the device and the io61 cache without being copied
+//    into the kernel’s page cache. O_DIRECT requires buffer addresses,
+//    file offsets, and lengths to be multiples of the device’s block
+//    size; `io61_direct_align` is a multiple of common block sizes.
+//
+//    Reads fill the cache from the aligned offset at or before
+//    `f->end_tag`. The cache of a written file always starts at an
+//    aligned offset. When a flush ends in a partial block, that block
+//    is written through the page cache but kept cached, so the next
+//    flush rewrites it in full with O_DIRECT. Seeking a written file to
+//    an unaligned offset turns O_DIRECT off for good.
+
+// io61_direct_start(f), io61_direct_stop(f)
+//    Turn O_DIRECT on or off for `f`’s file descriptor.
+//    `io61_direct_start` returns false if O_DIRECT can’t be used.
+
+static bool io61_direct_start(io61_file* f) {
+    if (!f->seekable
+        || (f->mode != O_RDONLY && f->tag % io61_direct_align != 0)) {
+        return false;
+    }
+    int fl = fcntl(f->fd, F_GETFL);
+    f->stats.syscalls += 2;
+    if (fl == -1 || fcntl(f->fd, F_SETFL, fl | O_DIRECT) == -1) {
+        return false;
+    }
+    f->direct = true;
+    return true;
+}
+
+static void io61_direct_stop(io61_file* f) {
+    int fl = fcntl(f->fd, F_GETFL);
+    f->stats.syscalls += 2;
+    if (fl != -1) {
+        fcntl(f->fd, F_SETFL, fl & ~O_DIRECT);
+    }
+    f->direct = false;
+}
+
+
+// io61_direct_fill(f)
+//    Fill the read cache for an O_DIRECT file. Returns 0 on success
+//    (including end of file) and -1 on error.
+
+static int io61_direct_fill(io61_file* f) {
+    off_t off = f->end_tag - f->end_tag % io61_direct_align;
+    while (true) {
+        ssize_t nr = pread(f->fd, f->cbuf, f->cbufsz, off);
+        ++f->stats.syscalls;
+        if (nr >= 0) {
+            f->stats.bytes_read += nr;
+            f->tag = off;
+            f->end_tag = off + nr;
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+
+// io61_direct_flush(f)
+//    Write the cached data of an O_DIRECT file. Returns 0 on success
+//    and -1 on error.
+
+static int io61_direct_flush(io61_file* f) {
+    size_t len = f->end_tag - f->tag;
+    size_t nfull = len - len % io61_direct_align;
+    size_t nw = 0;
+    while (nw != len) {
+        ssize_t r;
+        if (nw < nfull) {
+            r = pwrite(f->fd, &f->cbuf[nw], nfull - nw, f->tag + nw);
+        } else {
+            // Partial final block: write it through the page cache
+            io61_direct_stop(f);
+            r = pwrite(f->fd, &f->cbuf[nw], len - nw, f->tag + nw);
+            int err = errno;
+            io61_direct_start(f);
+            errno = err;
+        }
+        ++f->stats.syscalls;
+        if (r > 0) {
+            f->stats.bytes_written += r;
+            nw += r;
+        } else if (r == 0 || errno != EINTR) {
+            return -1;
+        }
+    }
+    // Keep the partial block so later flushes write whole blocks
+    memmove(&f->cbuf[0], &f->cbuf[nfull], len - nfull);
+    f->tag += nfull;
+    f->dirty = false;
+    return 0;
+}
+
+
+// READ-AHEAD
+//    With IO61_READAHEAD, a helper thread reads the next cache-sized
+//    blocks of the file while the caller consumes the current one, so
+//    that I/O overlaps with processing. Filled blocks are handed to the
+//    caller by swapping buffers with `f->cbuf`, so no data is copied.
+//
+//    Seekable files are read with `pread`, so a seek only needs to
+//    discard blocks read ahead from the wrong position; a generation
+//    number identifies blocks started before the most recent seek.
+
+struct io61_readahead {
+    static constexpr int nslots = 2;
+
+    struct slot {
+        unsigned char* buf;
+        off_t off;           // file offset of `buf[0]`
+        ssize_t len;         // number of bytes read, or -1 on error
+        int err;             // `errno` from failed read
+    };
+
+    std::mutex m;
+    std::condition_variable cv;
+    slot slots[nslots];
+    int nfree = nslots;      // `slots[0..nfree-1]` are free
+    int nfull = 0;           // `full[0..nfull-1]` are filled, oldest first
+    slot full[nslots];
+    off_t next_off;          // offset of next block to read
+    unsigned gen = 0;        // incremented by each seek
+    bool done = false;       // reached end of file or error
+    int err = 0;             // error delivered at `done`, reported again
+    bool stop = false;       // file is closing
+    int cancelfd[2];         // pipe used to interrupt `poll`
+    std::thread th;
+    unsigned long nsyscalls = 0;   // system calls made by the helper
+    unsigned long nbytes = 0;      // bytes read by the helper
+};
+
+
+// io61_readahead_read(f, buf, sz, off, regular, nsyscalls)
+//    Read up to `sz` bytes of `f` into `buf` on the helper thread, from
+//    offset `off` if `f` is seekable. Pipes, sockets, and terminals may
+//    block indefinitely, so a non-`regular` file is first polled
+//    alongside the cancellation pipe; if that is interrupted, returns -1
+//    with `errno` set to ECANCELED. Adds system calls to `nsyscalls`.
+
+static ssize_t io61_readahead_read(io61_file* f, unsigned char* buf,
+                                   size_t sz, off_t off, bool regular,
+                                   unsigned long& nsyscalls) {
+    if (!regular) {
+        struct pollfd pfd[2] = {
+            {f->fd, POLLIN, 0}, {f->ra->cancelfd[0], POLLIN, 0}
+        };
+        int r = poll(pfd, 2, -1);
+        ++nsyscalls;
+        if (r <= 0 || pfd[1].revents != 0) {
+            errno = ECANCELED;
+            return -1;
+        }
+    }
+    ++nsyscalls;
+    if (f->seekable) {
+        return pread(f->fd, buf, sz, off);
+    } else {
+        return read(f->fd, buf, sz);
+    }
+}
+
+
+// io61_readahead_thread(f)
+//    Helper thread body: fill free slots until end of file, error, or
+//    close. Compressed files are decompressed into the slots.
+
+static ssize_t io61_gzip_read(io61_file* f, unsigned char* buf, size_t sz,
+                              bool regular, unsigned long& nsyscalls,
+                              unsigned long& nbytes);
+
+static void io61_readahead_thread(io61_file* f) {
+    io61_readahead* ra = f->ra;
+    struct stat s;
+    bool regular = fstat(f->fd, &s) == 0 && S_ISREG(s.st_mode);
+
+    std::unique_lock guard(ra->m);
+    ++ra->nsyscalls;
+    while (true) {
+        ra->cv.wait(guard, [&] () {
+            return ra->stop || (ra->nfree > 0 && !ra->done);
+        });
+        if (ra->stop) {
+            return;
+        }
+        io61_readahead::slot sl = ra->slots[--ra->nfree];
+        sl.off = ra->next_off;
+        unsigned gen = ra->gen;
+        guard.unlock();
+
+        unsigned long nsyscalls = 0, nbytes = 0;
+        ssize_t nr;
+        if (f->gz) {
+            nr = io61_gzip_read(f, sl.buf, f->cbufsz, regular,
+                                nsyscalls, nbytes);
+        } else {
+            nr = io61_readahead_read(f, sl.buf, f->cbufsz, sl.off, regular,
+                                     nsyscalls);
+            nbytes = std::max(nr, ssize_t(0));
+        }
+        sl.len = nr;
+        sl.err = nr == -1 ? errno : 0;
+
+        guard.lock();
+        ra->nsyscalls += nsyscalls;
+        ra->nbytes += nbytes;
+        if (gen != ra->gen
+            || (nr == -1 && (sl.err == ECANCELED || sl.err == EINTR
+                             || sl.err == EAGAIN))) {
+            // Stale, cancelled, or interrupted read: drop the block and
+            // try again (a cancelled `poll` may have been EINTR)
+            ra->slots[ra->nfree++] = sl;
+            continue;
+        }
+        ra->full[ra->nfull++] = sl;
+        if (nr > 0) {
+            ra->next_off += nr;
+        } else {
+            ra->done = true;
+        }
+        ra->cv.notify_all();
+    }
+}
+
+
+// io61_readahead_start(f), io61_readahead_stop(f)
+//    Create and destroy the helper thread for `f`.
+
+static void io61_readahead_start(io61_file* f) {
+    io61_readahead* ra = new io61_readahead;
+    for (int i = 0; i != ra->nslots; ++i) {
+        ra->slots[i].buf = new unsigned char[f->cbufsz];
+    }
+    ra->next_off = f->end_tag;
+    int r = pipe(ra->cancelfd);
+    assert(r == 0);
+    f->ra = ra;
+    ra->th = std::thread(io61_readahead_thread, f);
+}
+
+static void io61_readahead_stop(io61_file* f) {
+    io61_readahead* ra = f->ra;
+    {
+        std::unique_lock guard(ra->m);
+        ra->stop = true;
+        ra->cv.notify_all();
+    }
+    ssize_t nw = write(ra->cancelfd[1], "", 1);
+    (void) nw;
+    ra->th.join();
+    f->stats.syscalls += ra->nsyscalls;
+    f->stats.bytes_read += ra->nbytes;
+    for (int i = 0; i != ra->nfree; ++i) {
+        delete[] ra->slots[i].buf;
+    }
+    for (int i = 0; i != ra->nfull; ++i) {
+        delete[] ra->full[i].buf;
+    }
+    close(ra->cancelfd[0]);
+    close(ra->cancelfd[1]);
+    delete ra;
+    f->ra = nullptr;
+}
+
+
+// io61_readahead_fill(f)
+//    Replace `f`’s cache with the next block read by the helper thread,
+//    waiting if it is not ready yet.
+
+static int io61_readahead_fill(io61_file* f) {
+    io61_readahead* ra = f->ra;
+    std::unique_lock guard(ra->m);
+    ra->cv.wait(guard, [&] () {
+        return ra->nfull > 0 || ra->done;
+    });
+    if (ra->nfull == 0) {
+        // end of file or error already delivered
+        f->tag = f->end_tag;
+        if (ra->err != 0) {
+            errno = ra->err;
+            return -1;
+        }
+        return 0;
+    }
+
+    io61_readahead::slot sl = ra->full[0];
+    --ra->nfull;
+    memmove(&ra->full[0], &ra->full[1], sizeof(ra->full[0]) * ra->nfull);
+    assert(sl.off == f->end_tag);
+    // Return the old cache buffer to the helper
+    ra->slots[ra->nfree++].buf = f->cbuf;
+    ra->cv.notify_all();
+    guard.unlock();
+
+    f->cbuf = sl.buf;
+    f->tag = f->end_tag = sl.off;
+    if (sl.len == -1) {
+        ra->err = errno = sl.err;
+        return -1;
+    }
+    f->end_tag += sl.len;
+    return 0;
+}
+
+
+// io61_readahead_reset(f, off)
+//    Discard blocks read ahead and restart reading at offset `off`.
+
+static void io61_readahead_reset(io61_file* f, off_t off) {
+    io61_readahead* ra = f->ra;
+    std::unique_lock guard(ra->m);
+    while (ra->nfull > 0) {
+        ra->slots[ra->nfree++] = ra->full[--ra->nfull];
+    }
+    ++ra->gen;
+    ra->next_off = off;
+    ra->done = false;
+    ra->err = 0;
+    ra->cv.notify_all();
+}
+
+
+// COMPRESSED STREAMS
+//    With IO61_GZIP, a read-only file whose data starts with a gzip header
+//    is decompressed on the read-ahead helper thread, so inflating the
+//    next block overlaps with the caller’s use of the current one. Other
+//    input passes through unchanged, and concatenated gzip members are
+//    decompressed in turn. Written files are deflated into gzip format as
+//    their cache fills; `io61_flush` makes the output so far
+//    decompressible, and `io61_close` adds the gzip trailer.
+//
+//    Offsets count uncompressed bytes, so compressed files can seek only
+//    within their cache. zstd frames are recognized, but there is no zstd
+//    decoder, so reading one fails with ENOTSUP. Without zlib,
+//    IO61_GZIP is ignored with a warning.
+
+enum io61_zformat { io61_zplain, io61_zgzip, io61_zzstd };
+
+// io61_gzip_format(p, n)
+//    Returns the format of data starting with the `n` bytes at `p`.
+
+[[maybe_unused]] static io61_zformat io61_gzip_format(const unsigned char* p,
+                                                      size_t n) {
+    if (n >= 2 && p[0] == 0x1F && p[1] == 0x8B) {
+        return io61_zgzip;
+    } else if (n >= 4 && memcmp(p, "\x28\xB5\x2F\xFD", 4) == 0) {
+        return io61_zzstd;
+    } else {
+        return io61_zplain;
+    }
+}
+
+#if IO61_HAVE_ZLIB
+
+struct io61_gzip {
+    static constexpr size_t bufsz = 65536;
+
+    z_stream zs;
+    unsigned char* buf;      // compressed data
+    // Reading: what the data at `zs.next_in` is
+    enum { detect, plain, member, between } state = detect;
+    bool ineof = false;      // reading: no more compressed data
+    bool unsynced = false;   // writing: deflated data not yet forced out
+};
+
+
+// io61_gzip_start(f), io61_gzip_stop(f)
+//    Set up and tear down compression for `f`. `io61_gzip_start` returns
+//    false if `f` is a seekable file that isn’t compressed; it stays
+//    seekable. Other input is examined by the helper thread.
+
+static bool io61_gzip_start(io61_file* f) {
+    if (f->mode == O_RDONLY && f->seekable) {
+        unsigned char hdr[4];
+        ssize_t nr = pread(f->fd, hdr, sizeof(hdr), f->tag);
+        ++f->stats.syscalls;
+        if (nr <= 0 || io61_gzip_format(hdr, nr) == io61_zplain) {
+            return false;
+        }
+    }
+    io61_gzip* gz = new io61_gzip;
+    memset(&gz->zs, 0, sizeof(gz->zs));
+    if (f->mode != O_RDONLY
+        && deflateInit2(&gz->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                        15 + 16 /* gzip format */, 8,
+                        Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete gz;
+        return false;
+    }
+    gz->buf = new unsigned char[gz->bufsz];
+    f->gz = gz;
+    f->seekable = false;
+    f->tag = f->pos_tag = f->end_tag = 0;
+    return true;
+}
+
+static void io61_gzip_stop(io61_file* f) {
+    io61_gzip* gz = f->gz;
+    if (f->mode != O_RDONLY) {
+        deflateEnd(&gz->zs);
+    } else if (gz->state == gz->member || gz->state == gz->between) {
+        inflateEnd(&gz->zs);
+    }
+    delete[] gz->buf;
+    delete gz;
+    f->gz = nullptr;
+}
+
+
+// io61_gzip_read(f, buf, sz, regular, nsyscalls, nbytes)
+//    Decompress up to `sz` bytes of `f` into `buf` on the helper thread.
+//    Returns the number of bytes produced, 0 at end of file, or -1 on
+//    error; corrupt or truncated data is EBADMSG. A pipe returns as soon
+//    as some data is ready rather than waiting for more. Adds system
+//    calls and compressed bytes read to `nsyscalls` and `nbytes`.
+
+static ssize_t io61_gzip_read(io61_file* f, unsigned char* buf, size_t sz,
+                              bool regular, unsigned long& nsyscalls,
+                              unsigned long& nbytes) {
+    io61_gzip* gz = f->gz;
+    z_stream& zs = gz->zs;
+    zs.next_out = buf;
+    zs.avail_out = sz;
+    while (zs.avail_out != 0) {
+        // Recognizing a format takes a few bytes
+        size_t need = gz->state == gz->detect || gz->state == gz->between
+            ? 4 : 1;
+        if (zs.avail_in < need && !gz->ineof) {
+            if (zs.avail_out != sz && !regular) {
+                break;
+            }
+            // Uncompressed data is read straight into `buf`
+            bool plain = gz->state == gz->plain;
+            if (!plain && zs.avail_in != 0) {
+                memmove(gz->buf, zs.next_in, zs.avail_in);
+            }
+            if (!plain) {
+                zs.next_in = gz->buf;
+            }
+            ssize_t nr;
+            if (plain) {
+                nr = io61_readahead_read(f, zs.next_out, zs.avail_out, 0,
+                                         regular, nsyscalls);
+            } else {
+                nr = io61_readahead_read(f, gz->buf + zs.avail_in,
+                                         gz->bufsz - zs.avail_in, 0,
+                                         regular, nsyscalls);
+            }
+            if (nr == -1 && zs.avail_out != sz) {
+                break;
+            } else if (nr == -1) {
+                return -1;
+            } else if (nr == 0) {
+                gz->ineof = true;
+            } else if (plain) {
+                zs.next_out += nr;
+                zs.avail_out -= nr;
+            } else {
+                zs.avail_in += nr;
+            }
+            nbytes += nr;
+            continue;
+        }
+
+        if (gz->state == gz->detect || gz->state == gz->between) {
+            io61_zformat fmt = io61_gzip_format(zs.next_in, zs.avail_in);
+            if (fmt == io61_zgzip) {
+                int r = gz->state == gz->detect
+                    ? inflateInit2(&zs, 15 + 16 /* gzip format */)
+                    : inflateReset(&zs);
+                if (r != Z_OK) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+                gz->state = gz->member;
+            } else if (gz->state == gz->between) {
+                // Like gzip, ignore anything after the last member
+                zs.avail_in = 0;
+                gz->ineof = true;
+                break;
+            } else if (fmt == io61_zzstd) {
+                errno = ENOTSUP;
+                return -1;
+            } else {
+                gz->state = gz->plain;
+            }
+        } else if (gz->state == gz->plain) {
+            size_t n = std::min(zs.avail_in, zs.avail_out);
+            if (n == 0) {
+                break;
+            }
+            memcpy(zs.next_out, zs.next_in, n);
+            zs.next_in += n;
+            zs.avail_in -= n;
+            zs.next_out += n;
+            zs.avail_out -= n;
+        } else {
+            int r = zs.avail_in == 0 ? Z_DATA_ERROR : inflate(&zs, Z_NO_FLUSH);
+            if (r == Z_STREAM_END) {
+                gz->state = gz->between;
+            } else if (r != Z_OK && r != Z_BUF_ERROR && zs.avail_out != sz) {
+                // Deliver the data decompressed so far; the error recurs
+                break;
+            } else if (r != Z_OK && r != Z_BUF_ERROR) {
+                errno = EBADMSG;
+                return -1;
+            }
+        }
+    }
+    return sz - zs.avail_out;
+}
+
+
+// io61_gzip_deflate(f, end)
+//    Compress `f`’s cached data and write the output zlib produces,
+//    leaving the cache empty. `io61_gzip_sync` forces out all the data
+//    compressed so far, and `io61_gzip_finish` ends the gzip stream.
+//    Returns 0 on success and -1 on error.
+
+static int io61_gzip_deflate(io61_file* f, io61_gzip_end end) {
+    io61_gzip* gz = f->gz;
+    z_stream& zs = gz->zs;
+    zs.next_in = f->cbuf;
+    zs.avail_in = f->end_tag - f->tag;
+    if (zs.avail_in == 0 && end == io61_gzip_sync && !gz->unsynced) {
+        return 0;
+    } else if (zs.avail_in != 0) {
+        ++f->stats.flushes;
+    }
+    int zflush = end == io61_gzip_more ? Z_NO_FLUSH
+        : end == io61_gzip_sync ? Z_SYNC_FLUSH : Z_FINISH;
+    do {
+        zs.next_out = gz->buf;
+        zs.avail_out = gz->bufsz;
+        int r = deflate(&zs, zflush);
+        assert(r != Z_STREAM_ERROR);
+        (void) r;
+        size_t n = gz->bufsz - zs.avail_out;
+        for (size_t nw = 0; nw != n; ) {
+            ssize_t w = write(f->fd, &gz->buf[nw], n - nw);
+            ++f->stats.syscalls;
+            if (w > 0) {
+                f->stats.bytes_written += w;
+                nw += w;
+            } else if (w == -1 && errno == EAGAIN) {
+                io61_wait(f, POLLOUT);
+            } else if (w == -1 && errno != EINTR) {
+                return -1;
+            }
+        }
+    } while (zs.avail_out == 0);
+    gz->unsynced = end == io61_gzip_more;
+    f->tag = f->end_tag;
+    f->dirty = false;
+    return 0;
+}
+
+#else
+
+static bool io61_gzip_start(io61_file*) {
+    static bool warned = false;
+    if (!warned) {
+        fprintf(stderr, "io61: built without zlib, ignoring IO61_GZIP\n");
+        warned = true;
+    }
+    return false;
+}
+
+static void io61_gzip_stop(io61_file*) {
+}
+
+static ssize_t io61_gzip_read(io61_file*, unsigned char*, size_t, bool,
+                              unsigned long&, unsigned long&) {
+    errno = ENOSYS;
+    return -1;
+}
+
+static int io61_gzip_deflate(io61_file*, io61_gzip_end) {
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+
+// IO_URING
+//    With IO61_URING, cache blocks are read and written with io_uring
+//    requests rather than `read`, `write`, and `lseek`. The file’s cache
+//    buffers are registered with the kernel, requests on seekable files
+//    carry their own offsets, and requests are submitted in batches:
+//    sequential reads keep several blocks in flight, and full write
+//    buffers are queued until every buffer is in use or the file is
+//    flushed. Unseekable files read one block ahead and link their
+//    queued writes so the kernel performs them in order.
+
+#if IO61_HAVE_URING
+
+struct io61_uring {
+    static constexpr int nbufs = 16;
+    static constexpr unsigned nentries = 2 * nbufs;
+    static constexpr uint64_t cancel_tag = ~uint64_t(0);
+
+    enum bstate { idle, queued, busy, done };
+    struct block {
+        unsigned char* buf;
+        bstate state = idle;
+        off_t off;           // file offset of `buf[0]`
+        size_t len;          // bytes to write
+        size_t nwritten;     // bytes written so far
+        int res;             // result of the last request
+    };
+
+    int ringfd = -1;
+    bool fixed = false;      // are the buffers registered?
+
+    // Submission queue
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    io_uring_sqe* sqes;
+    unsigned nsubmit = 0;    // entries prepared but not yet submitted
+
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    void* sq_map = MAP_FAILED;
+    size_t sq_maplen;
+    void* cq_map = MAP_FAILED;
+    size_t cq_maplen;
+    size_t sqes_maplen;
+
+    unsigned char* mem = nullptr;   // memory for all blocks
+    block blocks[nbufs];
+    int cur = 0;             // block backing `f->cbuf`
+    int order[nbufs];        // queued writes, oldest first
+    int norder = 0;
+    off_t next_off;          // offset of next block to read ahead
+    off_t seq_off;           // offset where a sequential fill would start
+    bool eof = false;        // read ahead to end of file
+
+    io61_stats* stats;       // owning file’s counters
+    bool writing;            // completions count as bytes written
+};
+
+
+// io61_uring_destroy(ur)
+//    Release `ur`’s ring and memory.
+
+static void io61_uring_destroy(io61_uring* ur) {
+    if (ur->sqes) {
+        munmap(ur->sqes, ur->sqes_maplen);
+    }
+    if (ur->cq_map != MAP_FAILED && ur->cq_map != ur->sq_map) {
+        munmap(ur->cq_map, ur->cq_maplen);
+    }
+    if (ur->sq_map != MAP_FAILED) {
+        munmap(ur->sq_map, ur->sq_maplen);
+    }
+    if (ur->ringfd >= 0) {
+        close(ur->ringfd);
+    }
+    free(ur->mem);
+    delete ur;
+}
+
+
+// io61_uring_start(f), io61_uring_stop(f)
+//    Create and destroy the io_uring state for `f`. `io61_uring_start`
+//    returns false if the kernel doesn’t support io_uring.
+
+static bool io61_uring_start(io61_file* f) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int ringfd = syscall(__NR_io_uring_setup, io61_uring::nentries, &p);
+    if (ringfd < 0) {
+        return false;
+    }
+    io61_uring* ur = new io61_uring;
+    ur->ringfd = ringfd;
+    ur->stats = &f->stats;
+    ur->writing = f->mode != O_RDONLY;
+    // setup, two or three mmaps, register
+    f->stats.syscalls += p.features & IORING_FEAT_SINGLE_MMAP ? 4 : 5;
+    ur->sq_maplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ur->cq_maplen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ur->sq_maplen = ur->cq_maplen = std::max(ur->sq_maplen, ur->cq_maplen);
+    }
+    ur->sq_map = mmap(nullptr, ur->sq_maplen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if (single_mmap) {
+        ur->cq_map = ur->sq_map;
+    } else {
+        ur->cq_map = mmap(nullptr, ur->cq_maplen, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+    }
+    ur->sqes_maplen = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, ur->sqes_maplen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+    ur->sqes = sqes == MAP_FAILED ? nullptr : (io_uring_sqe*) sqes;
+    if (ur->sq_map == MAP_FAILED || ur->cq_map == MAP_FAILED || !ur->sqes) {
+        io61_uring_destroy(ur);
+        return false;
+    }
+
+    char* sq = (char*) ur->sq_map;
+    ur->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    ur->sq_mask = *(unsigned*) (sq + p.sq_off.ring_mask);
+    ur->sq_array = (unsigned*) (sq + p.sq_off.array);
+    char* cq = (char*) ur->cq_map;
+    ur->cq_head = (unsigned*) (cq + p.cq_off.head);
+    ur->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    ur->cq_mask = *(unsigned*) (cq + p.cq_off.ring_mask);
+    ur->cqes = (io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    // Allocate and register the cache buffers
+    ur->mem = (unsigned char*) aligned_alloc(4096, io61_uring::nbufs * f->cbufsz);
+    struct iovec iov[io61_uring::nbufs];
+    for (int i = 0; i != io61_uring::nbufs; ++i) {
+        ur->blocks[i].buf = &ur->mem[i * f->cbufsz];
+        iov[i].iov_base = ur->blocks[i].buf;
+        iov[i].iov_len = f->cbufsz;
+    }
+    ur->fixed = syscall(__NR_io_uring_register, ringfd,
+                        IORING_REGISTER_BUFFERS, iov, io61_uring::nbufs) == 0;
+
+    ur->next_off = ur->seq_off = f->end_tag;
+    f->cbuf = ur->blocks[ur->cur].buf;
+    f->ur = ur;
+    return true;
+}
+
+static int io61_uring_cancel(io61_uring* ur);
+
+static void io61_uring_stop(io61_file* f) {
+    io61_uring* ur = f->ur;
+    if (io61_uring_cancel(ur) == -1) {
+        // requests may still target the buffers, so leak them
+        ur->mem = nullptr;
+    }
+    if (f->seekable) {
+        // Leave the file position where the system call backend would
+        lseek(f->fd, f->end_tag, SEEK_SET);
+        ++f->stats.syscalls;
+    }
+    io61_uring_destroy(ur);
+    f->ur = nullptr;
+    f->cbuf = nullptr;
+}
+
+
+// io61_uring_prep(ur, opcode, fd, off, addr, len, user_data)
+//    Add a request to `ur`’s submission queue and return it. It is
+//    submitted by the next `io61_uring_enter`.
+
+static io_uring_sqe* io61_uring_prep(io61_uring* ur, int opcode, int fd,
+                                     off_t off, void* addr, unsigned len,
+                                     uint64_t user_data) {
+    assert(ur->nsubmit < io61_uring::nentries);
+    unsigned tail = *ur->sq_tail;
+    unsigned idx = (tail + ur->nsubmit) & ur->sq_mask;
+    io_uring_sqe* sqe = &ur->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = off;
+    sqe->addr = (uintptr_t) addr;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    ur->sq_array[idx] = idx;
+    ++ur->nsubmit;
+    return sqe;
+}
+
+
+// io61_uring_prep_block(f, b, link)
+//    Queue a read or write request for block `b` of `f`. If `link`, the
+//    next request starts only after this one completes.
+
+static void io61_uring_prep_block(io61_file* f, int b, bool link) {
+    io61_uring* ur = f->ur;
+    io61_uring::block& bl = ur->blocks[b];
+    io_uring_sqe* sqe;
+    if (f->mode == O_RDONLY) {
+        sqe = io61_uring_prep(ur, ur->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ,
+                              f->fd, f->seekable ? bl.off : -1,
+                              bl.buf, f->cbufsz, b);
+    } else {
+        sqe = io61_uring_prep(ur, ur->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+                              f->fd, f->seekable ? off_t(bl.off + bl.nwritten) : -1,
+                              &bl.buf[bl.nwritten], bl.len - bl.nwritten, b);
+    }
+    sqe->buf_index = b;
+    if (link) {
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    bl.state = io61_uring::busy;
+}
+
+
+// io61_uring_enter(ur, min_complete)
+//    Submit prepared requests and wait for at least `min_complete`
+//    completions. Returns 0 on success and -1 on error.
+
+static int io61_uring_enter(io61_uring* ur, unsigned min_complete) {
+    if (ur->nsubmit != 0) {
+        // Publish the prepared entries
+        __atomic_store_n(ur->sq_tail, *ur->sq_tail + ur->nsubmit, __ATOMIC_RELEASE);
+    }
+    while (true) {
+        int r = syscall(__NR_io_uring_enter, ur->ringfd, ur->nsubmit,
+                        min_complete,
+                        min_complete ? IORING_ENTER_GETEVENTS : 0,
+                        nullptr, 0);
+        ++ur->stats->syscalls;
+        if (r >= 0) {
+            ur->nsubmit -= r;
+            if (ur->nsubmit == 0) {
+                return 0;
+            }
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -1;
+        }
+    }
+}
+
+
+// io61_uring_reap(ur)
+//    Record the results of completed requests in their blocks.
+
+static void io61_uring_reap(io61_uring* ur) {
+    unsigned head = *ur->cq_head;
+    unsigned tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        io_uring_cqe* cqe = &ur->cqes[head & ur->cq_mask];
+        if (cqe->user_data != io61_uring::cancel_tag) {
+            io61_uring::block& bl = ur->blocks[cqe->user_data];
+            bl.res = cqe->res;
+            if (bl.res > 0) {
+                (ur->writing ? ur->stats->bytes_written
+                 : ur->stats->bytes_read) += bl.res;
+            }
+            bl.state = io61_uring::done;
+        }
+    }
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+// io61_uring_wait(ur, b)
+//    Wait for block `b`’s request to complete, or, if `b < 0`, for all
+//    requests to complete. Returns 0 on success and -1 on error.
+
+static int io61_uring_wait(io61_uring* ur, int b) {
+    while (true) {
+        io61_uring_reap(ur);
+        bool busy = false;
+        for (int i = 0; i != io61_uring::nbufs; ++i) {
+            if ((b < 0 || i == b)
+                && ur->blocks[i].state == io61_uring::busy) {
+                busy = true;
+            }
+        }
+        if (!busy) {
+            return 0;
+        } else if (io61_uring_enter(ur, 1) == -1) {
+            return -1;
+        }
+    }
+}
+
+
+// io61_uring_cancel(ur)
+//    Cancel all outstanding requests (typically reads ahead), wait for
+//    them to finish, and mark every block idle.
+
+static int io61_uring_cancel(io61_uring* ur) {
+    io61_uring_reap(ur);
+    for (int i = 0; i != io61_uring::nbufs; ++i) {
+        if (ur->blocks[i].state == io61_uring::busy) {
+            io61_uring_prep(ur, IORING_OP_ASYNC_CANCEL, -1, 0,
+                            (void*) uintptr_t(i), 0, io61_uring::cancel_tag);
+        }
+    }
+    if (io61_uring_wait(ur, -1) == -1) {
+        return -1;
+    }
+    for (int i = 0; i != io61_uring::nbufs; ++i) {
+        ur->blocks[i].state = io61_uring::idle;
+    }
+    return 0;
+}
+
+
+// io61_uring_readahead(f)
+//    Start reads for idle blocks following the data read so far. Seekable
+//    files wait until half the blocks are idle so that reads are
+//    submitted in batches; unseekable files keep one read in flight.
+
+static int io61_uring_readahead(io61_file* f) {
+    io61_uring* ur = f->ur;
+    if (ur->eof) {
+        return 0;
+    }
+    int nidle = 0, nbusy = 0;
+    for (int i = 0; i != io61_uring::nbufs; ++i) {
+        if (i != ur->cur && ur->blocks[i].state == io61_uring::idle) {
+            ++nidle;
+        } else if (i != ur->cur) {
+            ++nbusy;
+        }
+    }
+    if (f->seekable ? nidle < io61_uring::nbufs / 2 && nbusy > 0 : nbusy > 0) {
+        return 0;
+    }
+    for (int i = 0; i != io61_uring::nbufs; ++i) {
+        if (i != ur->cur && ur->blocks[i].state == io61_uring::idle) {
+            ur->blocks[i].off = ur->next_off;
+            ur->next_off += f->cbufsz;
+            io61_uring_prep_block(f, i, false);
+            if (!f->seekable) {
+                break;
+            }
+        }
+    }
+    return io61_uring_enter(ur, 0);
+}
+
+
+// io61_uring_fill(f)
+//    Replace `f`’s read cache with the block at `f->end_tag`, reading it
+//    if no request for it is in flight.
+
+static int io61_uring_fill(io61_file* f) {
+    io61_uring* ur = f->ur;
+    off_t off = f->end_tag;
+    bool sequential = off == ur->seq_off;
+    ur->blocks[ur->cur].state = io61_uring::idle;
+
+    // Look for a block read ahead; unseekable files have at most one
+    int b = -1;
+    for (int i = 0; i != io61_uring::nbufs && b < 0; ++i) {
+        if (ur->blocks[i].state != io61_uring::idle
+            && (!f->seekable || ur->blocks[i].off == off)) {
+            b = i;
+        }
+    }
+    if (b < 0) {
+        // Discard blocks read ahead from elsewhere, then read this one
+        if (io61_uring_cancel(ur) == -1) {
+            return -1;
+        }
+        b = ur->cur;
+        ur->blocks[b].off = off;
+        io61_uring_prep_block(f, b, false);
+        ur->next_off = off + f->cbufsz;
+        ur->eof = false;
+    }
+
+    io61_uring::block& bl = ur->blocks[b];
+    while (true) {
+        if (io61_uring_wait(ur, b) == -1) {
+            return -1;
+        } else if (bl.res != -EINTR && bl.res != -EAGAIN) {
+            break;
+        }
+        if (bl.res == -EAGAIN) {
+            io61_wait(f, POLLIN);
+        }
+        io61_uring_prep_block(f, b, false);
+    }
+
+    ur->cur = b;
+    f->cbuf = bl.buf;
+    f->tag = f->end_tag = off;
+    if (bl.res < 0) {
+        errno = -bl.res;
+        return -1;
+    }
+    f->end_tag += bl.res;
+    ur->seq_off = f->end_tag;
+    if (bl.res == 0) {
+        ur->eof = true;
+    } else if (!f->seekable) {
+        ur->next_off = f->end_tag;
+    }
+    if (sequential || !f->seekable) {
+        io61_uring_readahead(f);
+    }
+    return 0;
+}
+
+
+// io61_uring_complete(f)
+//    Submit all queued writes for `f` in one batch and wait for them,
+//    resubmitting the unwritten parts of short or cancelled writes.
+//    Returns 0 on success and -1 on error.
+
+static int io61_uring_complete(io61_file* f) {
+    io61_uring* ur = f->ur;
+    while (ur->norder != 0) {
+        for (int i = 0; i != ur->norder; ++i) {
+            bool link = !f->seekable && i + 1 != ur->norder;
+            io61_uring_prep_block(f, ur->order[i], link);
+        }
+        if (io61_uring_wait(ur, -1) == -1) {
+            return -1;
+        }
+
+        // Retire finished writes; keep the rest, in order
+        int n = 0;
+        bool again = false;
+        for (int i = 0; i != ur->norder; ++i) {
+            io61_uring::block& bl = ur->blocks[ur->order[i]];
+            if (bl.res > 0) {
+                bl.nwritten += bl.res;
+            }
+            if (bl.nwritten == bl.len) {
+                bl.state = io61_uring::idle;
+                continue;
+            } else if (bl.res < 0
+                       && bl.res != -ECANCELED
+                       && bl.res != -EINTR
+                       && bl.res != -EAGAIN) {
+                // Drop the queued data, as a failed `write` would
+                for (int j = 0; j != ur->norder; ++j) {
+                    ur->blocks[ur->order[j]].state = io61_uring::idle;
+                }
+                ur->norder = 0;
+                errno = -bl.res;
+                return -1;
+            }
+            again = again || bl.res == -EAGAIN;
+            bl.state = io61_uring::queued;
+            ur->order[n] = ur->order[i];
+            ++n;
+        }
+        ur->norder = n;
+        if (again) {
+            io61_wait(f, POLLOUT);
+        }
+    }
+    return 0;
+}
+
+
+// io61_uring_queue(f)
+//    Queue `f`’s cached data for writing and switch the cache to an
+//    idle block, submitting the queue if no block is idle.
+
+static int io61_uring_queue(io61_file* f) {
+    io61_uring* ur = f->ur;
+    if (f->end_tag != f->tag) {
+        io61_uring::block& bl = ur->blocks[ur->cur];
+        bl.off = f->tag;
+        bl.len = f->end_tag - f->tag;
+        bl.nwritten = 0;
+        bl.state = io61_uring::queued;
+        ur->order[ur->norder] = ur->cur;
+        ++ur->norder;
+    }
+    int b = -1;
+    for (int i = 0; i != io61_uring::nbufs && b < 0; ++i) {
+        if (ur->blocks[i].state == io61_uring::idle) {
+            b = i;
+        }
+    }
+    if (b < 0) {
+        if (io61_uring_complete(f) == -1) {
+            f->tag = f->end_tag;
+            return -1;
+        }
+        b = ur->cur;
+    }
+    ur->cur = b;
+    f->cbuf = ur->blocks[b].buf;
+    f->tag = f->end_tag;
+    return 0;
+}
+
+
+// io61_uring_flush(f)
+//    Write all of `f`’s cached and queued data.
+
+static int io61_uring_flush(io61_file* f) {
+    io61_uring* ur = f->ur;
+    if (f->end_tag != f->tag) {
+        io61_uring::block& bl = ur->blocks[ur->cur];
+        bl.off = f->tag;
+        bl.len = f->end_tag - f->tag;
+        bl.nwritten = 0;
+        bl.state = io61_uring::queued;
+        ur->order[ur->norder] = ur->cur;
+        ++ur->norder;
+        f->tag = f->end_tag;
+    }
+    if (io61_uring_complete(f) == -1) {
+        return -1;
+    }
+    f->dirty = false;
+    return 0;
+}
+
+#else
+
+struct io61_uring {
+};
+
+static bool io61_uring_start(io61_file*) {
+    return false;
+}
+
+static void io61_uring_stop(io61_file*) {
+}
+
+static int io61_uring_fill(io61_file*) {
+    errno = ENOSYS;
+    return -1;
+}
+
+static int io61_uring_queue(io61_file*) {
+    errno = ENOSYS;
+    return -1;
+}
+
+static int io61_uring_flush(io61_file*) {
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+
+// io61_env_flags(mode)
+//    Returns the io61 mode flags requested by the `IO61` environment
+//    variable, a comma-separated list of mode names, for files opened
+//    with access mode `mode`.
+
+static int io61_env_flags(int mode) {
+    static int env_flags[2] = {-1, -1};   // read-only files, others
+    int which = mode == O_RDONLY ? 0 : 1;
+    if (env_flags[which] >= 0) {
+        return env_flags[which];
+    }
+    static const struct {
+        const char* name;
+        int flag;
+        bool rdonly;     // applies only to read-only files
+    } modes[] = {
+        {"readahead", IO61_READAHEAD, false},
+        {"uring", IO61_URING, false},
+        {"direct", IO61_DIRECT, false},
+        {"gzip", IO61_GZIP, false},
+        {"gunzip", IO61_GZIP, true}
+    };
+    env_flags[0] = env_flags[1] = 0;
+    const char* s = getenv("IO61");
+    while (s && *s) {
+        size_t len = strcspn(s, ", ");
+        bool found = false;
+        for (auto& m : modes) {
+            if (strlen(m.name) == len && memcmp(m.name, s, len) == 0) {
+                env_flags[0] |= m.flag;
+                env_flags[1] |= m.rdonly ? 0 : m.flag;
+                found = true;
+            }
+        }
+        if (!found && len != 0) {
+            fprintf(stderr, "io61: unknown IO61 mode `%.*s`\n", int(len), s);
+        }
+        s += len + strspn(s + len, ", ");
+    }
+    return env_flags[which];
+}
+
+
+// You shouldn't need to change these functions.
+
+// io61_open_check(filename, mode)
+//    Opens the file corresponding to `filename` and returns its io61_file.
+//    If `!filename`, returns either the standard input or the
+//    standard output, depending on `mode`. Exits with an error message if
+//    `filename != nullptr` and the named file cannot be opened.
+
+io61_file* io61_open_check(const char* filename, int mode) {
+    int fd;
+    if (filename) {
+        fd = open(filename, mode & ~IO61_MODEMASK, 0666);
+    } else if ((mode & O_ACCMODE) == O_RDONLY) {
+        fd = STDIN_FILENO;
+    } else {
+        fd = STDOUT_FILENO;
+    }
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_MODEMASK));
+}
+
+
+// io61_fileno(f)
+//    Returns the file descriptor associated with `f`.
+
+int io61_fileno(io61_file* f) {
+    return f->fd;
+}
+
+
+// io61_filesize(f)
+//    Returns the size of `f` in bytes. Returns -1 if `f` does not have a
+//    well-defined size (for instance, if it is a pipe).
+
+off_t io61_filesize(io61_file* f) {
+    if (f->gz) {
+        // The uncompressed size is unknown until the end
+        return -1;
+    }
     struct stat s;
     int r = fstat(f->fd, &s);
     if (r < 0 || !S_ISREG(s.st_mode)) {
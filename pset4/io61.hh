@@ -1,18 +1,37 @@
 #ifndef IO61_HH
 #define IO61_HH
 #include <cstdio>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
 #include <vector>
 #include <random>
 #include <optional>
+#include <type_traits>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sched.h>
+#include <sys/uio.h>
 
 struct io61_file;
 
+// io61 mode flags
+//    These may be combined with `O_RDONLY` or `O_WRONLY` in the `mode`
+//    argument to `io61_fdopen` and `io61_open_check`. They can also be
+//    requested for every file with the `IO61` environment variable,
+//    e.g. `IO61=readahead`.
+//
+//    Unlike the others, IO61_GZIP changes the data: gzip input is
+//    decompressed as it is read (other input passes through), and output
+//    is written in gzip format. `IO61=gzip` applies it to every file;
+//    `IO61=gunzip` applies it to input files only.
+constexpr int IO61_READAHEAD = 0x1000000;   // read ahead on a helper thread
+constexpr int IO61_URING = 0x2000000;       // use io_uring where available
+constexpr int IO61_DIRECT = 0x4000000;      // bypass the page cache (O_DIRECT)
+constexpr int IO61_GZIP = 0x8000000;        // gzip-compressed stream (zlib)
+constexpr int IO61_MODEMASK = 0xF000000;
+
 io61_file* io61_fdopen(int fd, int mode);
 io61_file* io61_open_check(const char* filename, int mode);
 int io61_fileno(io61_file* f);
@@ -22,14 +41,95 @@ off_t io61_filesize(io61_file* f);
 
 int io61_seek(io61_file* f, off_t off);
 
-int io61_readc(io61_file* f);
-int io61_writec(io61_file* f, int c);
+// io61_fastbuf
+//    Every io61_file starts with an `io61_fastbuf` that exposes a window
+//    of its cache. `io61_readc` and `io61_writec` use the window inline,
+//    like `getc_unlocked`, and call the library only when it is empty or
+//    full. Other io61 functions fold the window back into the file first.
+//    A library that grants no window leaves these pointers null.
+struct io61_fastbuf {
+    unsigned char* rpos = nullptr;   // next byte to read
+    unsigned char* rend = nullptr;   // end of readable window
+    unsigned char* wpos = nullptr;   // next byte to write
+    unsigned char* wend = nullptr;   // end of writable window
+};
+
+// io61_fastbuf_first<T>()
+//    Returns true if each `T` begins with its `io61_fastbuf` base, as the
+//    casts in `io61_readc` and `io61_writec` assume. `io61_file` is not
+//    standard-layout, so C++ does not guarantee this; every library
+//    checks it with `static_assert` after defining `io61_file`.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+template <typename T>
+constexpr bool io61_fastbuf_first() {
+    return std::is_base_of_v<io61_fastbuf, T>
+        && !std::is_polymorphic_v<T>
+        && offsetof(T, rpos) == 0;
+}
+#pragma GCC diagnostic pop
+
+int io61_readc_slow(io61_file* f);
+int io61_writec_slow(io61_file* f, int c);
+
+inline int io61_readc(io61_file* f) {
+    io61_fastbuf* fb = reinterpret_cast<io61_fastbuf*>(f);
+    if (fb->rpos != fb->rend) [[likely]] {
+        return *fb->rpos++;
+    }
+    return io61_readc_slow(f);
+}
+
+inline int io61_writec(io61_file* f, int c) {
+    io61_fastbuf* fb = reinterpret_cast<io61_fastbuf*>(f);
+    if (fb->wpos != fb->wend) [[likely]] {
+        *fb->wpos++ = c;
+        return 0;
+    }
+    return io61_writec_slow(f, c);
+}
 
 ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz);
+ssize_t io61_readline(io61_file* f, const unsigned char** linep, size_t sz);
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt);
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt);
 
 int io61_flush(io61_file* f);
 
+// io61 flush policies
+//    `io61_set_autoflush` chooses when cached output is written without an
+//    explicit `io61_flush`. Output to a terminal defaults to
+//    `IO61_FLUSH_LINE`; other output defaults to `IO61_FLUSH_FULL`.
+constexpr int IO61_FLUSH_FULL = 0;          // flush when the cache fills
+constexpr int IO61_FLUSH_LINE = 1;          // also flush after a newline
+
+int io61_set_autoflush(io61_file* f, int policy, double deadline = 0);
+
+ssize_t io61_copy(io61_file* in, io61_file* out, size_t n);
+ssize_t io61_copy_parallel(io61_file* in, io61_file* out, size_t n,
+                           int nthreads);
+
+// io61_stats
+//    Per-file counters kept by the io61 library. When a file is closed,
+//    its counters are reported with `io61_record_stats`, and the profiler
+//    includes them in its results.
+struct io61_stats {
+    int fd = -1;
+    int mode = 0;                       // O_RDONLY or O_WRONLY
+    unsigned long syscalls = 0;         // system calls made for this file
+    unsigned long bytes_read = 0;       // bytes read from the kernel
+    unsigned long bytes_written = 0;    // bytes written to the kernel
+    unsigned long hits = 0;             // calls satisfied by the cache
+    unsigned long misses = 0;           // calls that needed the kernel
+    unsigned long fills = 0;            // cache fills
+    unsigned long flushes = 0;          // flushes of dirty data
+    unsigned long seeks = 0;            // `io61_seek` calls
+};
+
+void io61_record_stats(const io61_stats& stats);
+
+
 int fd_open_check(const char* filename, int mode);
 FILE* stdio_open_check(const char* filename, int mode);
 
@@ -60,6 +160,9 @@ struct io61_args {
     double delay = 0.0;                 // `-D`: delay
     size_t pipebuf_size = 0;            // `-P`: pipe buffer size
     bool nonblocking = false;           // `-K`: nonblocking
+    bool line_flush = false;            // `-L`: flush output after lines
+    double flush_deadline = 0.0;        // `-d`: output flush deadline
+    int nthreads = 1;                   // `-j`: worker threads
 
     explicit io61_args(const char* opts, size_t block_size = 0);
 
@@ -10,22 +10,6 @@
 //    input files and "scattered" to many output files.
 //    Default BLOCKSIZE is 1.
 
-ssize_t read_line(io61_file* f, unsigned char* buf, size_t sz) {
-    size_t i = 0;
-    while (i != sz) {
-        int ch = io61_readc(f);
-        if (ch == EOF) {
-            break;
-        }
-        buf[i] = ch;
-        ++i;
-        if (ch == '\n') {
-            break;
-        }
-    }
-    return i;
-}
-
 ssize_t read_block(io61_file* f, unsigned char* buf, size_t sz) {
     size_t i = 0;
     while (i != sz) {
@@ -63,8 +47,9 @@ int main(int argc, char* argv[]) {
     while (!infs.empty()) {
         ini = (ini + 1) % infs.size();
         ssize_t nr;
+        const unsigned char* data = buf;
         if (args.read_lines) {
-            nr = read_line(infs[ini], buf, args.block_size);
+            nr = io61_readline(infs[ini], &data, args.block_size);
         } else {
             nr = read_block(infs[ini], buf, args.block_size);
         }
@@ -73,7 +58,7 @@ int main(int argc, char* argv[]) {
             infs.erase(infs.begin() + ini);
             --ini;
         } else {
-            ssize_t nw = io61_write(outfs[outi], buf, nr);
+            ssize_t nw = io61_write(outfs[outi], data, nr);
             assert(nw == nr);
             outi = (outi + 1) % outfs.size();
         }
@@ -11,10 +11,13 @@
 // io61_file
 //    Data structure for io61 file wrappers.
 
-struct io61_file {
+struct io61_file : io61_fastbuf {   // never grants a fast-path window
     FILE* f;
+    std::vector<unsigned char> linebuf;   // line from `io61_readline`
 };
 
+static_assert(io61_fastbuf_first<io61_file>());
+
 
 // io61_fdopen(fd, mode)
 //    Returns a new io61_file for file descriptor `fd`. `mode` is either
@@ -24,7 +27,7 @@ struct io61_file {
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
-    f->f = fdopen(fd, mode == O_RDONLY ? "r" : "w");
+    f->f = fdopen(fd, (mode & O_ACCMODE) == O_RDONLY ? "r" : "w");
     return f;
 }
 
@@ -40,11 +43,11 @@ int io61_close(io61_file* f) {
 }
 
 
-// io61_readc(f)
+// io61_readc_slow(f)
 //    Reads a single (unsigned) byte from `f` and returns it. Returns EOF,
 //    which equals -1, on end of file or error.
 
-int io61_readc(io61_file* f) {
+int io61_readc_slow(io61_file* f) {
     return fgetc(f->f);
 }
 
@@ -68,11 +71,38 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
 }
 
 
-// io61_writec(f)
+// io61_readline(f, linep, sz)
+//    Reads the next line from `f`, including its terminating newline,
+//    but no more than `sz` bytes. Sets `*linep` to point to the line and
+//    returns its length. Returns 0 on end of file and -1 if an error is
+//    encountered before any bytes are read. `*linep` remains valid only
+//    until the next operation on `f`.
+
+ssize_t io61_readline(io61_file* f, const unsigned char** linep, size_t sz) {
+    f->linebuf.clear();
+    while (f->linebuf.size() != sz) {
+        int ch = fgetc(f->f);
+        if (ch == EOF) {
+            break;
+        }
+        f->linebuf.push_back(ch);
+        if (ch == '\n') {
+            break;
+        }
+    }
+    if (f->linebuf.empty() && sz != 0 && ferror(f->f)) {
+        return -1;
+    }
+    *linep = f->linebuf.data();
+    return f->linebuf.size();
+}
+
+
+// io61_writec_slow(f, c)
 //    Write a single character `c` to `f` (converted to unsigned char).
 //    Returns 0 on success and -1 on error.
 
-int io61_writec(io61_file* f, int c) {
+int io61_writec_slow(io61_file* f, int c) {
     int r = fputc(c, f->f);
     if (r == EOF) {
         return -1;
@@ -97,6 +127,52 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 }
 
 
+// io61_readv(f, iov, iovcnt)
+//    Reads data from `f` into the `iovcnt` buffers described by `iov`,
+//    filling each in turn. Returns the total number of bytes read, with
+//    the same end-of-file and error conventions as `io61_read`.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nread = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t nr = io61_read(f, (unsigned char*) iov[i].iov_base,
+                               iov[i].iov_len);
+        if (nr == -1 && nread == 0) {
+            return -1;
+        } else if (nr > 0) {
+            nread += nr;
+        }
+        if (nr != ssize_t(iov[i].iov_len)) {
+            break;
+        }
+    }
+    return nread;
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Writes the `iovcnt` buffers described by `iov` to `f`, in order.
+//    Returns the total number of bytes written, with the same error
+//    conventions as `io61_write`.
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t nwritten = 0;
+    for (int i = 0; i != iovcnt; ++i) {
+        ssize_t nw = io61_write(f, (const unsigned char*) iov[i].iov_base,
+                                iov[i].iov_len);
+        if (nw == -1 && nwritten == 0) {
+            return -1;
+        } else if (nw > 0) {
+            nwritten += nw;
+        }
+        if (nw != ssize_t(iov[i].iov_len)) {
+            break;
+        }
+    }
+    return nwritten;
+}
+
+
 // io61_flush(f)
 //    If `f` was opened write-only, `io61_flush(f)` forces a write of any
 //    cached data written to `f`. Returns 0 on success; returns -1 if an error
@@ -110,6 +186,21 @@ int io61_flush(io61_file* f) {
 }
 
 
+// io61_set_autoflush(f, policy, deadline)
+//    Sets when `f`’s cached output is flushed. stdio supports line
+//    buffering but has no flush deadline, so `deadline` is ignored.
+
+int io61_set_autoflush(io61_file* f, int policy, double deadline) {
+    (void) deadline;
+    if (policy != IO61_FLUSH_FULL && policy != IO61_FLUSH_LINE) {
+        errno = EINVAL;
+        return -1;
+    }
+    return setvbuf(f->f, nullptr, policy == IO61_FLUSH_LINE ? _IOLBF : _IOFBF,
+                   BUFSIZ);
+}
+
+
 // io61_seek(f, off)
 //    Changes the file pointer for file `f` to `off` bytes into the file.
 //    Returns 0 on success and -1 on failure.
@@ -119,6 +210,41 @@ int io61_seek(io61_file* f, off_t off) {
 }
 
 
+// io61_copy(in, out, n)
+//    Copies up to `n` bytes from `in`, starting at its file position, to
+//    `out`. Returns the number of bytes copied, which is less than `n`
+//    only on end of file or error. Returns 0 if end-of-file is encountered
+//    before any bytes are copied, and -1 if an error is encountered before
+//    any bytes are copied.
+
+ssize_t io61_copy(io61_file* in, io61_file* out, size_t n) {
+    unsigned char buf[BUFSIZ];
+    size_t ncopied = 0;
+    while (ncopied != n) {
+        size_t nr = fread(buf, 1, std::min(n - ncopied, sizeof(buf)), in->f);
+        size_t nw = fwrite(buf, 1, nr, out->f);
+        ncopied += nw;
+        if (nr == 0 || nw != nr) {
+            break;
+        }
+    }
+    if (ncopied != 0 || n == 0 || (!ferror(in->f) && !ferror(out->f))) {
+        return ssize_t(ncopied);
+    }
+    return ssize_t(-1);
+}
+
+
+
+// io61_copy_parallel(in, out, n, nthreads)
+//    Like `io61_copy`. This version copies on the calling thread.
+
+ssize_t io61_copy_parallel(io61_file* in, io61_file* out, size_t n,
+                           int nthreads) {
+    (void) nthreads;
+    return io61_copy(in, out, n);
+}
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -130,7 +256,7 @@ int io61_seek(io61_file* f, off_t off) {
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename) {
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~IO61_MODEMASK, 0666);
     } else if ((mode & O_ACCMODE) == O_RDONLY) {
         fd = STDIN_FILENO;
     } else {
@@ -140,7 +266,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_MODEMASK));
 }
 
 
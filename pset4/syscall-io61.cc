@@ -11,11 +11,14 @@
 // io61_file
 //    Data structure for io61 file wrappers.
 
-struct io61_file {
+struct io61_file : io61_fastbuf {   // never grants a fast-path window
     int fd = -1;     // file descriptor
     int mode;        // open mode (O_RDONLY or O_WRONLY)
+    std::vector<unsigned char> linebuf;   // line from `io61_readline`
 };
 
+static_assert(io61_fastbuf_first<io61_file>());
+
 
 // io61_fdopen(fd, mode)
 //    Returns a new io61_file for file descriptor `fd`. `mode` is either
@@ -26,7 +29,7 @@ io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
     f->fd = fd;
-    f->mode = mode;
+    f->mode = mode & O_ACCMODE;
     return f;
 }
 
@@ -42,11 +45,11 @@ int io61_close(io61_file* f) {
 }
 
 
-// io61_readc(f)
+// io61_readc_slow(f)
 //    Reads a single (unsigned) byte from `f` and returns it. Returns EOF,
 //    which equals -1, on end of file or error.
 
-int io61_readc(io61_file* f) {
+int io61_readc_slow(io61_file* f) {
     unsigned char ch;
     ssize_t nr = read(f->fd, &ch, 1);
     if (nr != 1) {
@@ -75,11 +78,38 @@ ssize_t io61_read(io61_file* f, unsigned char* buf, size_t sz) {
 }
 
 
-// io61_writec(f)
+// io61_readline(f, linep, sz)
+//    Reads the next line from `f`, including its terminating newline,
+//    but no more than `sz` bytes. Sets `*linep` to point to the line and
+//    returns its length. Returns 0 on end of file and -1 if an error is
+//    encountered before any bytes are read. `*linep` remains valid only
+//    until the next operation on `f`.
+
+ssize_t io61_readline(io61_file* f, const unsigned char** linep, size_t sz) {
+    f->linebuf.clear();
+    while (f->linebuf.size() != sz) {
+        int ch = io61_readc(f);
+        if (ch == EOF) {
+            break;
+        }
+        f->linebuf.push_back(ch);
+        if (ch == '\n') {
+            break;
+        }
+    }
+    if (f->linebuf.empty() && sz != 0 && errno != 0) {
+        return -1;
+    }
+    *linep = f->linebuf.data();
+    return f->linebuf.size();
+}
+
+
+// io61_writec_slow(f, c)
 //    Write a single character `c` to `f` (converted to unsigned char).
 //    Returns 0 on success and -1 on error.
 
-int io61_writec(io61_file* f, int c) {
+int io61_writec_slow(io61_file* f, int c) {
     unsigned char ch = c;
     ssize_t nw = write(f->fd, &ch, 1);
     if (nw != 1) {
@@ -102,6 +132,26 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 }
 
 
+// io61_readv(f, iov, iovcnt)
+//    Reads data from `f` into the `iovcnt` buffers described by `iov`,
+//    filling each in turn. Returns the total number of bytes read, with
+//    the same end-of-file and error conventions as `io61_read`.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    return readv(f->fd, iov, iovcnt);
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Writes the `iovcnt` buffers described by `iov` to `f`, in order.
+//    Returns the total number of bytes written, with the same error
+//    conventions as `io61_write`.
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    return writev(f->fd, iov, iovcnt);
+}
+
+
 // io61_flush(f)
 //    If `f` was opened write-only, `io61_flush(f)` forces a write of any
 //    cached data written to `f`. Returns 0 on success; returns -1 if an error
@@ -116,6 +166,21 @@ int io61_flush(io61_file* f) {
 }
 
 
+// io61_set_autoflush(f, policy, deadline)
+//    Sets when `f`’s cached output is flushed. This version caches
+//    nothing, so every policy is already satisfied.
+
+int io61_set_autoflush(io61_file* f, int policy, double deadline) {
+    if (f->mode == O_RDONLY
+        || (policy != IO61_FLUSH_FULL && policy != IO61_FLUSH_LINE)
+        || deadline < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+
 // io61_seek(f, off)
 //    Changes the file pointer for file `f` to `off` bytes into the file.
 //    Returns 0 on success and -1 on failure.
@@ -130,6 +195,49 @@ int io61_seek(io61_file* f, off_t off) {
 }
 
 
+// io61_copy(in, out, n)
+//    Copies up to `n` bytes from `in`, starting at its file position, to
+//    `out`. Returns the number of bytes copied, which is less than `n`
+//    only on end of file or error. Returns 0 if end-of-file is encountered
+//    before any bytes are copied, and -1 if an error is encountered before
+//    any bytes are copied.
+
+ssize_t io61_copy(io61_file* in, io61_file* out, size_t n) {
+    unsigned char buf[8192];
+    size_t ncopied = 0;
+    while (ncopied != n) {
+        ssize_t nr = read(in->fd, buf, std::min(n - ncopied, sizeof(buf)));
+        if (nr <= 0) {
+            if (nr == -1 && ncopied == 0) {
+                return -1;
+            }
+            break;
+        }
+        ssize_t nw = write(out->fd, buf, nr);
+        if (nw > 0) {
+            ncopied += nw;
+        }
+        if (nw != nr) {
+            if (ncopied == 0) {
+                return -1;
+            }
+            break;
+        }
+    }
+    return ncopied;
+}
+
+
+
+// io61_copy_parallel(in, out, n, nthreads)
+//    Like `io61_copy`. This version copies on the calling thread.
+
+ssize_t io61_copy_parallel(io61_file* in, io61_file* out, size_t n,
+                           int nthreads) {
+    (void) nthreads;
+    return io61_copy(in, out, n);
+}
+
 // You shouldn't need to change these functions.
 
 // io61_open_check(filename, mode)
@@ -141,7 +249,7 @@ int io61_seek(io61_file* f, off_t off) {
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
     if (filename) {
-        fd = open(filename, mode, 0666);
+        fd = open(filename, mode & ~IO61_MODEMASK, 0666);
     } else if ((mode & O_ACCMODE) == O_RDONLY) {
         fd = STDIN_FILENO;
     } else {
@@ -151,7 +259,7 @@ io61_file* io61_open_check(const char* filename, int mode) {
         fprintf(stderr, "%s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_MODEMASK));
 }
 
 
@@ -497,6 +497,56 @@ if (testid_runnable("FTX5")) {
     run_one_check("./ftxxfer bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
 }
 
+if (testid_runnable("FTX6")) {
+    print OUT "\n${Cyan}Test FTX6: ./ftxxfer -j 32 -n 20000 bigaccounts.fdb check...${Off}\n";
+    run_one_check("./ftxxfer -j 32 -n 20000 bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
+}
+
+if (testid_runnable("FTX7")) {
+    print OUT "\n${Cyan}Test FTX7: ./ftxxfer -m bigaccounts.fdb check...${Off}\n";
+    run_one_check("./ftxxfer -m bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
+}
+
+if (testid_runnable("FTX8")) {
+    print OUT "\n${Cyan}Test FTX8: ./ftxxfer -S bigaccounts.fdb check...${Off}\n";
+    run_one_check("./ftxxfer -S bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
+}
+
+if (testid_runnable("FTX9")) {
+    print OUT "\n${Cyan}Test FTX9: ./ftxatomic -j 32 -n 20000 check...${Off}\n";
+    run_one_check("./ftxatomic -j 32 -n 20000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX10")) {
+    print OUT "\n${Cyan}Test FTX10: ./ftxblockchain -j 32 -n 20000 check...${Off}\n";
+    run_one_check("./ftxblockchain -j 32 -n 20000", "./diff-ftxdb.pl -l");
+}
+
+if (testid_runnable("FTX11")) {
+    print OUT "\n${Cyan}Test FTX11: ./ftxxfer -U -j 32 -n 5000 check...${Off}\n";
+    run_one_check("./ftxxfer -U -j 32 -n 5000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX12")) {
+    print OUT "\n${Cyan}Test FTX12: ./ftxaudit -j 6 -J 2 check...${Off}\n";
+    run_one_check("./ftxaudit -j 6 -J 2 -n 20000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX13")) {
+    print OUT "\n${Cyan}Test FTX13: ./ftxxfer -T 64 -n 20000 check...${Off}\n";
+    run_one_check("./ftxxfer -T 64 -n 20000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX14")) {
+    print OUT "\n${Cyan}Test FTX14: ./ftxatomic -j 32 -J 4 audit check...${Off}\n";
+    run_one_check("./ftxatomic -j 32 -J 4 -n 20000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("FTX15")) {
+    print OUT "\n${Cyan}Test FTX15: ./ftxdeadlock check...${Off}\n";
+    run_one_check("./ftxdeadlock", "./diff-ftxdb.pl");
+}
+
 
 set_param("SAN", 1);
 
@@ -515,4 +565,49 @@ if (testid_runnable("SAN3")) {
     run_one_check("./ftxxfer -n 10000 bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
 }
 
+if (testid_runnable("SAN4")) {
+    print OUT "\n${Cyan}Test SAN4: ./ftxxfer -m bigaccounts.fdb check with sanitizers...${Off}\n";
+    run_one_check("./ftxxfer -m -n 10000 bigaccounts.fdb", "./diff-ftxdb.pl bigaccounts.fdb");
+}
+
+if (testid_runnable("SAN5")) {
+    print OUT "\n${Cyan}Test SAN5: ./ftxblockchain -S check with sanitizers...${Off}\n";
+    run_one_check("./ftxblockchain -S -n 10000", "./diff-ftxdb.pl -l");
+}
+
+if (testid_runnable("SAN6")) {
+    print OUT "\n${Cyan}Test SAN6: ./ftxatomic check with sanitizers...${Off}\n";
+    run_one_check("./ftxatomic -n 10000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN7")) {
+    print OUT "\n${Cyan}Test SAN7: ./ftxxfer -U check with sanitizers...${Off}\n";
+    run_one_check("./ftxxfer -U -j 16 -n 2000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN8")) {
+    print OUT "\n${Cyan}Test SAN8: ./ftxaudit check with sanitizers...${Off}\n";
+    run_one_check("./ftxaudit -j 6 -J 2 -n 2000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN9")) {
+    print OUT "\n${Cyan}Test SAN9: ./ftxrocket -J2 check with sanitizers...${Off}\n";
+    run_one_check("./ftxrocket -J2 -n 5000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN10")) {
+    print OUT "\n${Cyan}Test SAN10: ./ftxaudit -T 16 check with sanitizers...${Off}\n";
+    run_one_check("./ftxaudit -T 16 -n 5000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN11")) {
+    print OUT "\n${Cyan}Test SAN11: ./ftxatomic -J 2 audit check with sanitizers...${Off}\n";
+    run_one_check("./ftxatomic -j 6 -J 2 -n 5000", "./diff-ftxdb.pl");
+}
+
+if (testid_runnable("SAN12")) {
+    print OUT "\n${Cyan}Test SAN12: ./ftxdeadlock check with sanitizers...${Off}\n";
+    run_one_check("./ftxdeadlock", "./diff-ftxdb.pl");
+}
+
 exit(0);
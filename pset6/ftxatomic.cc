@@ -0,0 +1,123 @@
+#include "ftxdb.hh"
+#include <sys/resource.h>
+#include <thread>
+#include <atomic>
+
+// Usage: ./ftxatomic [-j NTHREADS] [-J NAUDITORS] [-n NOPS] [-m] [FILE]
+//    Perform NOPS “bank transfers” in each of NTHREADS - NAUDITORS
+//    threads within FILE. Balances are kept in the binary shadow and
+//    moved under per-account sequence locks instead of range locks.
+//    Meanwhile, NAUDITORS threads (default 0) repeatedly sum every
+//    balance without blocking transfers and check that no money was
+//    created or destroyed.
+
+static std::atomic<bool> transfers_done;
+
+static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
+                            unsigned seed) {
+    // Obtain a source of random account numbers
+    std::mt19937 randomness(seed);
+    std::uniform_int_distribution pick_account(size_t(0), db.naccounts - 1);
+    std::normal_distribution pick_amount(100.0, 10.0);
+
+    size_t i = 0;
+    while (i != nops) {
+        // Pick two random accounts for transfer
+        size_t aindex[2] = {
+            pick_account(randomness), pick_account(randomness)
+        };
+        if (aindex[0] == aindex[1]) {
+            continue;
+        }
+
+        // Model network delay or heavy computation
+        usleep(1);
+
+        // Transfer; no locks needed
+        db.atomic_transfer(aindex[0], aindex[1],
+                           (long) pick_amount(randomness));
+
+        ++i;
+    }
+    opcount = i;
+}
+
+static void audit_thread(ftx_db& db, long expected,
+                         size_t& nauditsref, size_t& nbadref) {
+    size_t naudits = 0, nbad = 0;
+    while (!transfers_done) {
+        if (db.atomic_total() != expected) {
+            ++nbad;
+        }
+        ++naudits;
+        std::this_thread::yield();
+    }
+    nauditsref = naudits;
+    nbadref = nbad;
+}
+
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("i:D:j:J:n:m").set_nthreads(4)
+        .set_noperations(100'000)
+        .parse(argc, argv);
+    args.shadow = true;
+
+    // Allocate buffer, open files
+    ftx_db* db = ftx_db::open_args(args);
+    args.after_open(db->f, O_RDWR);
+    long expected = db->atomic_total();
+    std::random_device seed_randomness;
+    double start_time = monotonic_timestamp();
+
+    // Run auditors and transfers
+    int nauditors = args.ndistinguished_threads;
+    std::vector<std::thread> th(args.nthreads);
+    std::vector<size_t> opcounts(args.nthreads, 0);
+    std::vector<size_t> nbad(nauditors, 0);
+    for (int i = 0; i != args.nthreads; ++i) {
+        if (i < nauditors) {
+            th[i] = std::thread(audit_thread, std::ref(*db), expected,
+                                std::ref(opcounts[i]), std::ref(nbad[i]));
+        } else {
+            th[i] = std::thread(transfer_thread, std::ref(*db),
+                                args.noperations, std::ref(opcounts[i]),
+                                seed_randomness());
+        }
+    }
+
+    size_t totalops = 0;
+    for (int i = nauditors; i != args.nthreads; ++i) {
+        th[i].join();
+        totalops += opcounts[i];
+    }
+    transfers_done = true;
+    size_t naudits = 0, totalbad = 0;
+    for (int i = 0; i != nauditors; ++i) {
+        th[i].join();
+        naudits += opcounts[i];
+        totalbad += nbad[i];
+    }
+
+    // Flush and close
+    delete db;
+
+    double end_time = monotonic_timestamp();
+    struct rusage usage;
+    int r = getrusage(RUSAGE_SELF, &usage);
+    assert(r == 0);
+    fprintf(stderr, "%d %s, %zu %s, %d.%06ds CPU time, %.6fs real time\n",
+            args.nthreads, args.nthreads == 1 ? "thread" : "threads",
+            totalops, totalops == 1 ? "operation" : "operations",
+            (int) usage.ru_utime.tv_sec, (int) usage.ru_utime.tv_usec,
+            end_time - start_time);
+    if (nauditors != 0) {
+        fprintf(stderr, "%zu %s\n", naudits,
+                naudits == 1 ? "audit" : "audits");
+    }
+    if (totalbad != 0) {
+        fprintf(stderr, "%zu audits found the wrong total!\n", totalbad);
+        exit(1);
+    }
+}
@@ -0,0 +1,127 @@
+#include "ftxdb.hh"
+#include <sys/resource.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+// Usage: ./ftxaudit [-j NTHREADS] [-J NAUDITORS] [-n NOPS] [-T BATCH] [-E] [FILE]
+//    Perform NOPS “bank transfers” in each of NTHREADS - NAUDITORS
+//    threads within FILE. Meanwhile, NAUDITORS threads repeatedly sum
+//    every balance under a shared lock on the whole database and check
+//    that no money was created or destroyed. With `-E`, audits take an
+//    exclusive lock instead, for comparison. With `-T`, transfers are
+//    grouped BATCH at a time into `ftx_txn` transactions.
+
+static std::atomic<bool> transfers_done;
+static size_t batch_size;
+
+static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
+                            unsigned seed) {
+    if (batch_size > 1) {
+        opcount = ftx_batch_transfers(db, nops, seed, batch_size);
+    } else {
+        opcount = ftx_transfers(db, nops, seed);
+    }
+}
+
+
+// Return the sum of all balances. The caller must hold a lock covering
+// the whole database.
+static long sum_balances(ftx_db& db) {
+    long total = 0;
+    for (size_t i = 0; i != db.naccounts; ++i) {
+        long balance;
+        int r = ftx_acct(db, i).read(nullptr, 0, &balance);
+        assert(r == 0);
+        total += balance;
+    }
+    return total;
+}
+
+static void audit_thread(ftx_db& db, int locktype, long expected,
+                         size_t& nauditsref, size_t& nbadref) {
+    size_t naudits = 0, nbad = 0;
+    off_t dbsize = db.naccounts * db.asize;
+    while (!transfers_done) {
+        int r = io61_lock(db.f, 0, dbsize, locktype);
+        assert(r == 0);
+        long total = sum_balances(db);
+        io61_unlock(db.f, 0, dbsize);
+        ++naudits;
+        if (total != expected) {
+            ++nbad;
+        }
+    }
+    nauditsref = naudits;
+    nbadref = nbad;
+}
+
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("i:D:j:J:n:T:mSE").set_nthreads(4)
+        .set_noperations(100'000)
+        .set_ndistinguished_threads(1)
+        .parse(argc, argv);
+
+    // Allocate buffer, open files
+    ftx_db* db = ftx_db::open_args(args);
+    args.after_open(db->f, O_RDWR);
+    long expected = sum_balances(*db);
+    batch_size = args.batch_size;
+    std::random_device seed_randomness;
+    double start_time = monotonic_timestamp();
+
+    // Run auditors and transfers
+    int nauditors = args.ndistinguished_threads;
+    std::vector<std::thread> th(args.nthreads);
+    std::vector<size_t> opcounts(args.nthreads, 0);
+    std::vector<size_t> nbad(nauditors, 0);
+    for (int i = 0; i != args.nthreads; ++i) {
+        if (i < nauditors) {
+            th[i] = std::thread(audit_thread, std::ref(*db),
+                                args.lock_exclusive ? LOCK_EX : LOCK_SH,
+                                expected, std::ref(opcounts[i]),
+                                std::ref(nbad[i]));
+        } else {
+            th[i] = std::thread(transfer_thread, std::ref(*db),
+                                args.noperations, std::ref(opcounts[i]),
+                                seed_randomness());
+        }
+    }
+
+    size_t totalops = 0;
+    for (int i = nauditors; i != args.nthreads; ++i) {
+        th[i].join();
+        totalops += opcounts[i];
+    }
+    double transfer_time = monotonic_timestamp() - start_time;
+    transfers_done = true;
+    size_t naudits = 0, totalbad = 0;
+    for (int i = 0; i != nauditors; ++i) {
+        th[i].join();
+        naudits += opcounts[i];
+        totalbad += nbad[i];
+    }
+
+    // Flush and close
+    delete db;
+
+    double end_time = monotonic_timestamp();
+    struct rusage usage;
+    int r = getrusage(RUSAGE_SELF, &usage);
+    assert(r == 0);
+    fprintf(stderr, "%d %s, %zu %s, %d.%06ds CPU time, %.6fs real time\n",
+            args.nthreads, args.nthreads == 1 ? "thread" : "threads",
+            totalops, totalops == 1 ? "operation" : "operations",
+            (int) usage.ru_utime.tv_sec, (int) usage.ru_utime.tv_usec,
+            end_time - start_time);
+    fprintf(stderr, "%zu %s (%s locks), %.0f transfers/s\n",
+            naudits, naudits == 1 ? "audit" : "audits",
+            args.lock_exclusive ? "exclusive" : "shared",
+            totalops / transfer_time);
+    if (totalbad != 0) {
+        fprintf(stderr, "%zu audits found the wrong total!\n", totalbad);
+        exit(1);
+    }
+}
@@ -2,14 +2,142 @@
 #include <sys/resource.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 
-// Usage: ./ftxblockchain [-j NTHREADS] [-n NOPS] [FILE]
+// Usage: ./ftxblockchain [-j NTHREADS] [-n NOPS] [-m] [-S] [FILE]
 //    Perform NOPS * NTHREADS “bank transfers” within FILE, writing
 //    a ledger to LEDGER (defaults to ledger.db).
 
 static io61_args args;
 static io61_file* ledgerf;
 
+
+// ftx_ledger
+//    Group-commit ledger. Transfer threads append fixed-size entries to a
+//    multi-producer ring; a single committer thread writes each run of
+//    published entries to `ledgerf` in one `io61_write`.
+//
+//    A thread takes its ticket (its position in the ledger) while still
+//    holding both account locks, so the ledger orders each account’s
+//    entries the same way the transfers happened. Entries are written in
+//    ticket order, and each entry’s two lines stay contiguous.
+
+struct ftx_ledger {
+    static constexpr size_t capacity = 1 << 15;   // entries in ring
+    static constexpr size_t wake_batch = 1 << 12; // wake committer early
+    static constexpr auto commit_interval = std::chrono::milliseconds(1);
+
+    size_t esize;                                 // bytes per entry
+    std::unique_ptr<char[]> buf;                  // `capacity * esize`
+    std::unique_ptr<std::atomic<unsigned>[]> seq; // `ticket + 1` if published
+    std::atomic<size_t> tail = 0;                 // next ticket
+    std::atomic<size_t> head = 0;                 // next ticket to write
+    std::atomic<bool> done = false;
+    std::thread committer;
+
+    // When it has nothing to write, the committer sleeps on `cv` for up
+    // to `commit_interval`, letting entries accumulate into one batch
+    std::mutex m;
+    std::condition_variable cv;
+    std::atomic<bool> sleeping = false;
+
+    explicit ftx_ledger(size_t esize);
+    ~ftx_ledger();
+    size_t reserve();
+    void publish(size_t ticket, const char* entry);
+
+  private:
+    void commit_loop();
+};
+
+ftx_ledger::ftx_ledger(size_t esize_)
+    : esize(esize_), buf(new char[capacity * esize_]),
+      seq(new std::atomic<unsigned>[capacity]()) {
+    this->committer = std::thread(&ftx_ledger::commit_loop, this);
+}
+
+// Write all published entries, then stop the committer
+ftx_ledger::~ftx_ledger() {
+    this->done = true;
+    {
+        std::lock_guard guard(this->m);
+        this->cv.notify_one();
+    }
+    this->committer.join();
+}
+
+// Return the next ticket. Waits while the ring is full. Call with the
+// entry’s account locks held.
+size_t ftx_ledger::reserve() {
+    size_t t = this->tail.fetch_add(1);
+    size_t h;
+    while (t - (h = this->head.load(std::memory_order_acquire)) >= capacity) {
+        this->head.wait(h);
+    }
+    return t;
+}
+
+// Fill the slot for `ticket` with `entry` and hand it to the committer
+void ftx_ledger::publish(size_t ticket, const char* entry) {
+    memcpy(&this->buf[(ticket % capacity) * this->esize], entry, this->esize);
+    this->seq[ticket % capacity].store(ticket + 1, std::memory_order_release);
+    if (this->sleeping
+        && ticket + 1 - this->head.load(std::memory_order_relaxed)
+           >= wake_batch) {
+        std::lock_guard guard(this->m);
+        this->cv.notify_one();
+    }
+}
+
+void ftx_ledger::commit_loop() {
+    size_t h = 0;
+    while (true) {
+        // Find the run of published entries starting at `h`; it ends at
+        // the first unpublished entry or at the end of the ring
+        size_t t = h;
+        size_t limit = h + capacity - h % capacity;
+        while (t != limit
+               && this->seq[t % capacity].load(std::memory_order_acquire)
+                  == unsigned(t + 1)) {
+            ++t;
+        }
+
+        if (t == h) {
+            if (this->done && h == this->tail) {
+                return;
+            }
+            // Nothing to write: sleep a while, or until woken
+            std::unique_lock guard(this->m);
+            this->sleeping = true;
+            if (!this->done) {
+                this->cv.wait_for(guard, commit_interval);
+            }
+            this->sleeping = false;
+            continue;
+        }
+
+        // Write the run with one call
+        const char* data = &this->buf[(h % capacity) * this->esize];
+        size_t n = (t - h) * this->esize;
+        ssize_t np;
+        if (args.write_bytewise) {
+            np = io61_write_bytewise(ledgerf, data, n);
+        } else {
+            np = io61_write(ledgerf, data, n);
+        }
+        assert(np == ssize_t(n));
+
+        h = t;
+        this->head.store(h, std::memory_order_release);
+        this->head.notify_all();
+    }
+}
+
+static ftx_ledger* ledger;
+
 static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
                             unsigned seed) {
     // Obtain a source of random account numbers
@@ -52,19 +180,18 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
         acct1.write(bal[0]);
         acct2.write(bal[1]);
 
-        // Write to ledger
+        // Claim a ledger position while both accounts are still locked
+        size_t ticket = ledger->reserve();
+        guard2.unlock();
+        guard1.unlock();
+
+        // Append to ledger
         char report[128];
         size_t n = snprintf(report, sizeof(report),
                             "%-7s %+7ld\n%-7s %+7ld\n",
                             name1, -delta, name2, +delta);
         assert(n == db.asize * 2 && n < sizeof(report));
-        ssize_t np;
-        if (args.write_bytewise) {
-            np = io61_write_bytewise(ledgerf, report, n);
-        } else {
-            np = io61_write(ledgerf, report, n);
-        }
-        assert(np == ssize_t(n));
+        ledger->publish(ticket, report);
 
         ++i;
     }
@@ -74,7 +201,7 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    args = io61_args("i:D:j:n:W").set_nthreads(4)
+    args = io61_args("i:D:j:n:WmS").set_nthreads(4)
         .set_noperations(100'000)
         .parse(argc, argv);
 
@@ -86,6 +213,7 @@ int main(int argc, char* argv[]) {
     }
     ledgerf = io61_open_check(args.output_file, O_WRONLY | O_CREAT | O_TRUNC);
     args.after_open(ledgerf, O_WRONLY);
+    ledger = new ftx_ledger(db->asize * 2);
     std::random_device seed_randomness;
     double start_time = monotonic_timestamp();
 
@@ -105,6 +233,7 @@ int main(int argc, char* argv[]) {
     }
 
     // Flush and close
+    delete ledger;
     delete db;
     io61_close(ledgerf);
 
@@ -1,10 +1,13 @@
 #ifndef FTXDB_HH
 #define FTXDB_HH
 #include "io61.hh"
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <random>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 struct ftx_acct;
 
 
@@ -13,14 +16,27 @@ struct ftx_acct;
 
 struct ftx_db {
     io61_file* f;              // the file
+    char* map = nullptr;       // file data, if memory-mapped
     size_t naccounts;          // number of accounts in the file
     size_t asize = 16;         // size of an account record
     size_t balance_offset = 8; // offset of balance field within record
     size_t balance_size = 7;   // size of balance field within record
+    long max_balance = 9'999'999; // largest balance that fits
     static constexpr size_t max_asize = 512; // maximum asize allowed
 
-    ftx_db(io61_file* f);
+    // Binary shadow: if `balances` is set, account balances live here
+    // and reach the file only when `flush` writes back dirty entries.
+    // Each entry is protected by its account’s lock, or, in programs
+    // that use `atomic_transfer`, by its sequence lock in `seqs`.
+    std::unique_ptr<long[]> balances;
+    std::unique_ptr<bool[]> dirty;
+    std::unique_ptr<std::atomic<unsigned>[]> seqs;
+
+    ftx_db(io61_file* f, bool mmap = false, bool shadow = false);
     ~ftx_db();
+    int flush();
+    long atomic_transfer(size_t from, size_t to, long amount);
+    long atomic_total() const;
     static ftx_db* open_args(const io61_args& args);
 };
 
@@ -30,15 +46,19 @@ struct ftx_db {
 
 struct ftx_acct {
     const ftx_db& db;
+    size_t aindex;
     off_t offset;
     bool locked = false;
 
     inline ftx_acct(const ftx_db& db, size_t aindex);
 
     inline void lock();
+    inline bool try_lock();
+    inline int lock_detect();
     inline void unlock();
     inline int read(char* namebuf, size_t namesz, long* balance) const;
     inline int write(long balance) const;
+    inline int write_text(long balance) const;
 
     static int parse(
         const char* buf, size_t len, const ftx_db& db,
@@ -50,9 +70,65 @@ struct ftx_acct {
 };
 
 
+// ftx_txn
+//    A batch of transfers within one `ftx_db`. `add` queues transfers.
+//    `lock` locks every account the batch touches, once each, in account
+//    order (adjacent accounts share one range lock), and reads their
+//    balances. `commit` then applies the transfers in the order they were
+//    added, writes each changed balance once, unlocks, and empties the
+//    batch. Each transfer moves at most what its source holds and what
+//    fits in its destination, as a single locked transfer would.
+
+struct ftx_txn {
+    ftx_db& db;
+
+    explicit ftx_txn(ftx_db& db);
+    ~ftx_txn();
+
+    void add(size_t from, size_t to, long amount);
+    size_t size() const {
+        return this->transfers.size();
+    }
+    void lock();
+    void commit();
+
+  private:
+    struct transfer {
+        size_t from;
+        size_t to;
+        long amount;
+    };
+    std::vector<transfer> transfers;
+    std::vector<size_t> accounts;    // accounts touched, sorted
+    std::vector<long> balances;      // balance of each of `accounts`
+    std::vector<long> original;      // balances as read by `lock`
+    std::vector<std::pair<off_t, off_t>> ranges; // locked (offset, length)
+
+    size_t position(size_t aindex) const;
+};
+
+
+// ftx_transfers(db, nops, seed, unordered, nbackoffs)
+// ftx_batch_transfers(db, nops, seed, batch_size)
+//    Transfer workloads shared by `ftxxfer` and `ftxaudit`. Each performs
+//    `nops` transfers between random pairs of accounts and returns the
+//    number performed; every transfer models a delay while its accounts
+//    are locked. `ftx_transfers` locks each pair in account order, or,
+//    if `unordered`, in the order picked, backing off (and counting in
+//    `*nbackoffs`) when io61_lock reports a deadlock; that requires
+//    deadlock detection. `ftx_batch_transfers` groups `batch_size`
+//    transfers into each `ftx_txn`.
+
+size_t ftx_transfers(ftx_db& db, size_t nops, unsigned seed,
+                     bool unordered = false,
+                     std::atomic<size_t>* nbackoffs = nullptr);
+size_t ftx_batch_transfers(ftx_db& db, size_t nops, unsigned seed,
+                           size_t batch_size);
+
+
 // Create an account object for account number `aindex`
-inline ftx_acct::ftx_acct(const ftx_db& db_, size_t aindex)
-    : db(db_) {
+inline ftx_acct::ftx_acct(const ftx_db& db_, size_t aindex_)
+    : db(db_), aindex(aindex_) {
     assert(aindex < this->db.naccounts);
     this->offset = aindex * this->db.asize;
 }
@@ -67,6 +143,26 @@ inline void ftx_acct::lock() {
 }
 
 
+// Try to lock this account without blocking; return true on success
+inline bool ftx_acct::try_lock() {
+    assert(!this->locked);
+    int r = io61_try_lock(this->db.f, this->offset, this->db.asize, LOCK_EX);
+    this->locked = r == 0;
+    return this->locked;
+}
+
+
+// Lock this account, unless that would deadlock; then return -1 with
+// `errno == EDEADLK`. Requires deadlock detection on the database file.
+inline int ftx_acct::lock_detect() {
+    assert(!this->locked);
+    int r = io61_lock(this->db.f, this->offset, this->db.asize, LOCK_EX);
+    assert(r == 0 || errno == EDEADLK);
+    this->locked = r == 0;
+    return r;
+}
+
+
 // Unlock this account
 inline void ftx_acct::unlock() {
     assert(this->locked);
@@ -79,6 +175,23 @@ inline void ftx_acct::unlock() {
 // Read this account’s current name and/or balance, storing the name
 // in `namebuf[0..namesz-1]` and the balance in `*balance`
 inline int ftx_acct::read(char* namebuf, size_t namesz, long* balance) const {
+    // The binary shadow needs no parsing; names still come from the file
+    if (this->db.balances) {
+        if (balance) {
+            *balance = this->db.balances[this->aindex];
+        }
+        if (!namebuf || namesz == 0) {
+            return 0;
+        }
+        balance = nullptr;
+    }
+
+    // A mapped database is parsed in place
+    if (this->db.map) {
+        return parse(this->db.map + this->offset, this->db.asize, this->db,
+                     namebuf, namesz, balance);
+    }
+
     // Read account from file; short reads are errors
     char buf[ftx_db::max_asize];
     ssize_t nr = io61_pread(this->db.f, buf, this->db.asize, this->offset);
@@ -93,6 +206,17 @@ inline int ftx_acct::read(char* namebuf, size_t namesz, long* balance) const {
 
 // Write `balance` to the account database as this account’s new balance
 inline int ftx_acct::write(long balance) const {
+    if (this->db.balances) {
+        this->db.balances[this->aindex] = balance;
+        this->db.dirty[this->aindex] = true;
+        return 0;
+    }
+    return this->write_text(balance);
+}
+
+
+// Write `balance` into this account’s record in the file or mapping
+inline int ftx_acct::write_text(long balance) const {
     // Stringify balance to stack buffer
     char buf[ftx_db::max_asize];
     auto [ptr, len] = unparse(buf, sizeof(buf), this->db, balance);
@@ -100,7 +224,12 @@ inline int ftx_acct::write(long balance) const {
         return -1;
     }
 
-    // Write unparsed balance to database file
+    // Write unparsed balance to mapping or database file
+    if (this->db.map) {
+        memcpy(this->db.map + this->offset + this->db.balance_offset,
+               ptr, len);
+        return 0;
+    }
     ssize_t nw = io61_pwrite(this->db.f, ptr, len,
                              this->offset + this->db.balance_offset);
     if (size_t(nw) != len) {
@@ -0,0 +1,95 @@
+#include "ftxdb.hh"
+#include <thread>
+#include <atomic>
+
+// Usage: ./ftxdeadlock [FILE]
+//    Check that io61_lock detects a deadlock that runs through a shared
+//    lock holder other than the first one a waiter finds.
+//
+//    Readers 1 and 2 share-lock account A; the writer exclusively locks
+//    account B. The writer then asks for A exclusively and waits for both
+//    readers. Finally reader 2 asks for B exclusively: reader 2 waits for
+//    the writer, which waits for reader 2, so one of those requests must
+//    fail with EDEADLK. Reader 1’s range is listed first, so a detector
+//    that follows only one conflicting holder would miss the cycle and
+//    hang. Exits 1 if no deadlock is reported, or on timeout.
+
+static std::atomic<int> step;
+static std::atomic<int> ndeadlocks;
+
+static void wait_step(int s) {
+    while (step < s) {
+        usleep(1000);
+    }
+}
+
+// Lock, counting EDEADLK; returns true if the lock was acquired
+static bool lock_or_count(ftx_db& db, off_t off, int locktype) {
+    if (io61_lock(db.f, off, db.asize, locktype) == 0) {
+        return true;
+    }
+    assert(errno == EDEADLK);
+    ++ndeadlocks;
+    return false;
+}
+
+// Play role 0 (reader 1), 1 (reader 2), or 2 (the writer)
+static void lock_thread(ftx_db& db, int role) {
+    off_t a = 0, b = 4 * db.asize;
+    if (role == 0) {
+        io61_lock(db.f, a, db.asize, LOCK_SH);
+        step = 1;
+        wait_step(4);
+        io61_unlock(db.f, a, db.asize);
+    } else if (role == 1) {
+        wait_step(1);
+        io61_lock(db.f, a, db.asize, LOCK_SH);
+        step = 2;
+        wait_step(3);
+        // Give the writer time to block on A
+        usleep(100000);
+        bool got_b = lock_or_count(db, b, LOCK_EX);
+        io61_unlock(db.f, a, db.asize);
+        step = 4;
+        if (got_b) {
+            io61_unlock(db.f, b, db.asize);
+        }
+    } else {
+        wait_step(2);
+        io61_lock(db.f, b, db.asize, LOCK_EX);
+        step = 3;
+        bool got_a = lock_or_count(db, a, LOCK_EX);
+        io61_unlock(db.f, b, db.asize);
+        if (got_a) {
+            io61_unlock(db.f, a, db.asize);
+        }
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_args args = io61_args("i:").parse(argc, argv);
+
+    // Open files; A is account 0 and B is account 4
+    ftx_db* db = ftx_db::open_args(args);
+    assert(db->naccounts >= 8);
+    io61_set_deadlock_detection(db->f, true);
+    alarm(10);
+
+    // Run the three threads
+    std::vector<std::thread> th(3);
+    for (int i = 0; i != 3; ++i) {
+        th[i] = std::thread(lock_thread, std::ref(*db), i);
+    }
+    for (int i = 0; i != 3; ++i) {
+        th[i].join();
+    }
+
+    delete db;
+    fprintf(stderr, "%d %s detected\n", ndeadlocks.load(),
+            ndeadlocks == 1 ? "deadlock" : "deadlocks");
+    if (ndeadlocks == 0) {
+        exit(1);
+    }
+}
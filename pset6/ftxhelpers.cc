@@ -1,13 +1,26 @@
 #include "ftxdb.hh"
+#include <algorithm>
+#include <atomic>
 #include <charconv>
 #include <cstdlib>
+#include <sys/mman.h>
+#include <thread>
 
-ftx_db::ftx_db(io61_file* f_) {
+ftx_db::ftx_db(io61_file* f_, bool mmap, bool shadow) {
     this->f = f_;
     size_t sz = io61_filesize(this->f);
     assert(sz % this->asize == 0);
     this->naccounts = sz / this->asize;
 
+    // map the whole file if requested; on failure, fall back to io61
+    if (mmap && sz != 0) {
+        void* p = ::mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         io61_fileno(this->f), 0);
+        if (p != MAP_FAILED) {
+            this->map = reinterpret_cast<char*>(p);
+        }
+    }
+
     // ensure data is cached
     ftx_acct acct(*this, 0);
     char buf[ftx_db::max_asize];
@@ -15,13 +28,343 @@ ftx_db::ftx_db(io61_file* f_) {
     int r = acct.read(buf, sizeof(buf), &balance);
     assert(r == 0);
     assert(balance >= 0);
+
+    // parse every balance once into the binary shadow, if requested
+    if (shadow) {
+        std::unique_ptr<long[]> bal(new long[this->naccounts]);
+        for (size_t i = 0; i != this->naccounts; ++i) {
+            r = ftx_acct(*this, i).read(nullptr, 0, &bal[i]);
+            assert(r == 0);
+        }
+        this->dirty.reset(new bool[this->naccounts]());
+        this->seqs.reset(new std::atomic<unsigned>[this->naccounts]());
+        this->balances = std::move(bal);
+    }
 }
 
 ftx_db::~ftx_db() {
+    int r = this->flush();
+    assert(r == 0);
+    if (this->map) {
+        size_t sz = this->naccounts * this->asize;
+        msync(this->map, sz, MS_SYNC);
+        munmap(this->map, sz);
+    }
     io61_close(this->f);
 }
 
 
+// Write dirty shadow balances back to the file in text form.
+// Returns 0 on success and -1 on error.
+int ftx_db::flush() {
+    if (!this->balances) {
+        return 0;
+    }
+    int r = 0;
+    for (size_t i = 0; i != this->naccounts; ++i) {
+        ftx_acct acct(*this, i);
+        std::lock_guard guard(acct);
+        if (this->dirty[i]) {
+            if (acct.write_text(this->balances[i]) == 0) {
+                this->dirty[i] = false;
+            } else {
+                r = -1;
+            }
+        }
+    }
+    return r;
+}
+
+
+// Sequence locks for `atomic_transfer`
+//    `seqs[i]` is even while account `i` is idle and odd while a transfer
+//    is changing it. A transfer makes both of its sequence numbers odd,
+//    in account order, updates both balances, then makes both even again,
+//    so every reader that checks the sequence numbers sees the two
+//    balances change in one step. Readers never block transfers.
+
+static void seq_begin(std::atomic<unsigned>& seq) {
+    unsigned v = seq.load(std::memory_order_relaxed);
+    while ((v & 1) != 0
+           || !seq.compare_exchange_weak(v, v + 1, std::memory_order_acquire,
+                                         std::memory_order_relaxed)) {
+        std::this_thread::yield();
+        v = seq.load(std::memory_order_relaxed);
+    }
+}
+
+static void seq_end(std::atomic<unsigned>& seq) {
+    seq.store(seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
+
+// Move up to `amount` from account `from` to account `to` without taking
+// range locks. Requires the binary shadow. Both balances change under
+// the accounts’ sequence locks, so no reader ever sees money missing or
+// duplicated, no balance goes negative or above `max_balance`, and the
+// total is conserved at every instant. Transfers touching a common
+// account wait for each other (briefly: no I/O happens under a sequence
+// lock); taking the two in account order prevents deadlock. Returns the
+// amount moved.
+long ftx_db::atomic_transfer(size_t from, size_t to, long amount) {
+    assert(this->balances && from != to);
+    assert(from < this->naccounts && to < this->naccounts);
+    seq_begin(this->seqs[std::min(from, to)]);
+    seq_begin(this->seqs[std::max(from, to)]);
+
+    std::atomic_ref<long> bal_from(this->balances[from]);
+    std::atomic_ref<long> bal_to(this->balances[to]);
+    long vfrom = bal_from.load(std::memory_order_relaxed);
+    long vto = bal_to.load(std::memory_order_relaxed);
+    long delta = std::min(vfrom, amount);
+    delta = std::min(delta, this->max_balance - vto);
+    if (delta > 0) {
+        bal_from.store(vfrom - delta, std::memory_order_relaxed);
+        bal_to.store(vto + delta, std::memory_order_relaxed);
+        this->dirty[from] = this->dirty[to] = true;
+    }
+
+    seq_end(this->seqs[std::max(from, to)]);
+    seq_end(this->seqs[std::min(from, to)]);
+    return std::max(delta, 0L);
+}
+
+// Return the sum of all balances as of a single instant, without
+// blocking `atomic_transfer`. Retries while transfers overlap the scan.
+long ftx_db::atomic_total() const {
+    assert(this->balances);
+    std::vector<unsigned> before(this->naccounts);
+    while (true) {
+        bool idle = true;
+        for (size_t i = 0; i != this->naccounts && idle; ++i) {
+            before[i] = this->seqs[i].load(std::memory_order_acquire);
+            idle = (before[i] & 1) == 0;
+        }
+        if (!idle) {
+            std::this_thread::yield();
+            continue;
+        }
+        long total = 0;
+        for (size_t i = 0; i != this->naccounts; ++i) {
+            // acquire keeps the checks below after these loads
+            total += std::atomic_ref(this->balances[i])
+                .load(std::memory_order_acquire);
+        }
+        bool same = true;
+        for (size_t i = 0; i != this->naccounts && same; ++i) {
+            same = this->seqs[i].load(std::memory_order_relaxed) == before[i];
+        }
+        if (same) {
+            return total;
+        }
+    }
+}
+
+
+ftx_txn::ftx_txn(ftx_db& db_)
+    : db(db_) {
+}
+
+ftx_txn::~ftx_txn() {
+    assert(this->ranges.empty());
+}
+
+// Queue a transfer of up to `amount` from account `from` to account `to`
+void ftx_txn::add(size_t from, size_t to, long amount) {
+    assert(this->ranges.empty());
+    assert(from != to);
+    assert(from < this->db.naccounts && to < this->db.naccounts);
+    this->transfers.push_back({from, to, amount});
+}
+
+// Lock every account in the batch and read its balance. Locks are taken
+// in increasing offset order, so batches in different threads cannot
+// deadlock, and a run of adjacent accounts takes one range lock.
+void ftx_txn::lock() {
+    assert(this->ranges.empty());
+    this->accounts.clear();
+    for (auto& t : this->transfers) {
+        this->accounts.push_back(t.from);
+        this->accounts.push_back(t.to);
+    }
+    std::sort(this->accounts.begin(), this->accounts.end());
+    this->accounts.erase(std::unique(this->accounts.begin(),
+                                     this->accounts.end()),
+                         this->accounts.end());
+
+    for (size_t i = 0; i != this->accounts.size(); ) {
+        size_t j = i + 1;
+        while (j != this->accounts.size()
+               && this->accounts[j] == this->accounts[j - 1] + 1) {
+            ++j;
+        }
+        off_t off = this->accounts[i] * this->db.asize;
+        off_t len = (j - i) * this->db.asize;
+        int r = io61_lock(this->db.f, off, len, LOCK_EX);
+        assert(r == 0);
+        this->ranges.emplace_back(off, len);
+        i = j;
+    }
+
+    this->balances.resize(this->accounts.size());
+    for (size_t i = 0; i != this->accounts.size(); ++i) {
+        ftx_acct(this->db, this->accounts[i])
+            .read(nullptr, 0, &this->balances[i]);
+    }
+    this->original = this->balances;
+}
+
+// Return the index of account `aindex` in `accounts`
+size_t ftx_txn::position(size_t aindex) const {
+    auto it = std::lower_bound(this->accounts.begin(), this->accounts.end(),
+                               aindex);
+    assert(it != this->accounts.end() && *it == aindex);
+    return it - this->accounts.begin();
+}
+
+// Apply the locked batch, write changed balances, and unlock
+void ftx_txn::commit() {
+    assert(!this->ranges.empty() || this->transfers.empty());
+    for (auto& t : this->transfers) {
+        long& from = this->balances[this->position(t.from)];
+        long& to = this->balances[this->position(t.to)];
+        long delta = std::min(from, t.amount);
+        delta = std::min(delta, this->db.max_balance - to);
+        from -= delta;
+        to += delta;
+    }
+
+    for (size_t i = 0; i != this->accounts.size(); ++i) {
+        if (this->balances[i] != this->original[i]) {
+            ftx_acct(this->db, this->accounts[i]).write(this->balances[i]);
+        }
+    }
+
+    while (!this->ranges.empty()) {
+        auto [off, len] = this->ranges.back();
+        int r = io61_unlock(this->db.f, off, len);
+        assert(r == 0);
+        this->ranges.pop_back();
+    }
+    this->transfers.clear();
+}
+
+
+// Lock `a` then `b`, releasing `a` and retrying whenever io61_lock
+// reports that waiting for `b` would deadlock
+static void lock_unordered(ftx_acct& a, ftx_acct& b,
+                           std::atomic<size_t>* nbackoffs) {
+    while (true) {
+        if (a.lock_detect() == 0) {
+            if (b.lock_detect() == 0) {
+                return;
+            }
+            a.unlock();
+        }
+        if (nbackoffs) {
+            ++*nbackoffs;
+        }
+        std::this_thread::yield();
+    }
+}
+
+// Perform `nops` transfers between random accounts, one at a time.
+// Returns the number of transfers performed.
+size_t ftx_transfers(ftx_db& db, size_t nops, unsigned seed,
+                     bool unordered, std::atomic<size_t>* nbackoffs) {
+    // Obtain a source of random account numbers
+    std::mt19937 randomness(seed);
+    std::uniform_int_distribution pick_account(size_t(0), db.naccounts - 1);
+    std::normal_distribution pick_amount(100.0, 10.0);
+
+    size_t i = 0;
+    while (i != nops) {
+        // Pick two random accounts for transfer
+        size_t aindex[2] = {
+            pick_account(randomness), pick_account(randomness)
+        };
+        if (aindex[0] == aindex[1]) {
+            continue;
+        }
+
+        // Lock both accounts; prevent deadlock with lock ordering,
+        // or, if `unordered`, by backing off
+        ftx_acct acct1{db, aindex[0]};
+        ftx_acct acct2{db, aindex[1]};
+        ftx_acct& first = unordered || aindex[0] < aindex[1] ? acct1 : acct2;
+        ftx_acct& second = &first == &acct1 ? acct2 : acct1;
+        if (unordered) {
+            lock_unordered(first, second, nbackoffs);
+        }
+        std::unique_lock guard1 = unordered
+            ? std::unique_lock{first, std::adopt_lock}
+            : std::unique_lock{first};
+        std::unique_lock guard2 = unordered
+            ? std::unique_lock{second, std::adopt_lock}
+            : std::unique_lock{second};
+
+        // Read current balances
+        long bal[2];
+        acct1.read(nullptr, 0, &bal[0]);
+        acct2.read(nullptr, 0, &bal[1]);
+
+        // Model network delay or heavy computation
+        usleep(1);
+
+        // Compute amount to transfer
+        long delta = std::min(bal[0], (long) pick_amount(randomness));
+        delta = std::min(delta, db.max_balance - bal[1]);
+        bal[0] -= delta;
+        bal[1] += delta;
+
+        // Update balances
+        acct1.write(bal[0]);
+        acct2.write(bal[1]);
+
+        ++i;
+    }
+    return i;
+}
+
+// Perform `nops` transfers between random accounts, `batch_size` per
+// `ftx_txn`. Returns the number of transfers performed.
+size_t ftx_batch_transfers(ftx_db& db, size_t nops, unsigned seed,
+                           size_t batch_size) {
+    // Obtain a source of random account numbers
+    std::mt19937 randomness(seed);
+    std::uniform_int_distribution pick_account(size_t(0), db.naccounts - 1);
+    std::normal_distribution pick_amount(100.0, 10.0);
+
+    ftx_txn txn(db);
+    size_t i = 0;
+    while (i != nops) {
+        // Pick two random accounts for transfer
+        size_t aindex[2] = {
+            pick_account(randomness), pick_account(randomness)
+        };
+        if (aindex[0] == aindex[1]) {
+            continue;
+        }
+        txn.add(aindex[0], aindex[1], (long) pick_amount(randomness));
+        ++i;
+
+        if (txn.size() == batch_size || i == nops) {
+            // Lock and read every account in the batch
+            txn.lock();
+
+            // Model network delay or heavy computation, per transfer
+            for (size_t k = 0; k != txn.size(); ++k) {
+                usleep(1);
+            }
+
+            // Apply transfers, update balances, unlock
+            txn.commit();
+        }
+    }
+    return i;
+}
+
+
 ftx_db* ftx_db::open_args(const io61_args& args) {
     const char* original = args.input_file;
     if (original == nullptr) {
@@ -48,7 +391,7 @@ ftx_db* ftx_db::open_args(const io61_args& args) {
         assert(r == 0);
     }
     io61_file* f = io61_open_check(copy, O_RDWR);
-    return new ftx_db(f);
+    return new ftx_db(f, args.mmap, args.shadow);
 }
 
 
@@ -2,13 +2,277 @@
 #include <sys/resource.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
 
-// Usage: ./ftxrocket [-j NTHREADS] [-n NOPS] [FILE]
+// Usage: ./ftxrocket [-j NTHREADS] [-J NSBF] [-n NOPS] [-m] [-S] [FILE]
 //    Perform NOPS * NTHREADS “bank transfers” within FILE, completely
-//    legally.
+//    legally. NSBF of the threads mostly move money among accounts 0-2,
+//    which makes those accounts hot. Prints each thread’s rate.
+
+// Per-thread results
+struct thread_stats {
+    size_t nops = 0;            // transfers completed
+    size_t nsplit = 0;          // transfers that used a split account
+    size_t nmerged = 0;         // of those, transfers that merged slots
+    double end_time = 0;        // when the thread finished
+};
+
+
+// Split accounts
+//    An account whose lock is found busy more than about a fifth of the
+//    time (each busy lock adds 4 to `nbusy`, each free one subtracts 1)
+//    is split: its balance is spread over `nslots` slots, each with its
+//    own lock and its own share of `max_balance`. Thread `t` normally
+//    locks only slot `t % nslots`, so transfers through a hot account in
+//    different threads no longer serialize, yet each still reads,
+//    computes (with the modeled delay), and writes while holding locks on
+//    both of its accounts.
+//
+//    A transfer must behave as if the account were whole. If the
+//    thread’s slot holds less than the amount, or has too little room
+//    for it, the transfer unlocks and retries holding every slot of that
+//    account, in slot order. It then sees the merged balance and
+//    headroom, and respreads the new total evenly over the slots. Locks
+//    are always taken in (account, slot) order, so merging cannot
+//    deadlock. The slots are merged back into the account when the run
+//    ends.
+
+struct split_account {
+    struct alignas(64) slot {
+        std::mutex m;
+        long balance;
+        long cap;
+    };
+    std::unique_ptr<slot[]> slots;
+
+    void spread(long total, long max_balance);
+};
+
+static int nslots;
+static std::unique_ptr<std::atomic<split_account*>[]> split;
+static std::unique_ptr<std::atomic<unsigned>[]> nbusy;
+static constexpr unsigned split_threshold = 32;
+static thread_local int slotindex;
+
+
+// split_account::spread(total, max_balance)
+//    Divide `total` evenly among the slots, and the account’s remaining
+//    room below `max_balance` among their caps. Every slot must be locked
+//    or not yet shared.
+
+void split_account::spread(long total, long max_balance) {
+    long room = max_balance - total;
+    for (int i = 0; i != nslots; ++i) {
+        long share = total / nslots + (i < total % nslots);
+        this->slots[i].balance = share;
+        this->slots[i].cap = share + room / nslots + (i < room % nslots);
+    }
+}
+
+
+// make_split(db, a)
+//    Split account `a`, unless it is already split. Takes the account’s
+//    lock, so it must be called with no locks held.
+
+static void make_split(ftx_db& db, size_t a) {
+    ftx_acct acct{db, a};
+    std::unique_lock guard{acct};
+    if (split[a].load(std::memory_order_relaxed)) {
+        return;
+    }
+    long bal;
+    acct.read(nullptr, 0, &bal);
+    auto sa = new split_account;
+    sa->slots.reset(new split_account::slot[nslots]);
+    sa->spread(bal, db.max_balance);
+    split[a].store(sa, std::memory_order_release);
+}
+
+
+// merge_splits(db)
+//    Write every split account’s total back to its record. Call after
+//    all transfers finish.
+
+static void merge_splits(ftx_db& db) {
+    for (size_t a = 0; a != db.naccounts; ++a) {
+        if (auto sa = split[a].load(std::memory_order_acquire)) {
+            long total = 0;
+            for (int i = 0; i != nslots; ++i) {
+                total += sa->slots[i].balance;
+            }
+            ftx_acct(db, a).write(total);
+            delete sa;
+            split[a] = nullptr;
+        }
+    }
+}
+
+
+// A locked side of a transfer: a whole account, the calling thread’s
+// slot of a split account, or, if `merge` is set, every slot of a split
+// account
+struct locked_side {
+    ftx_acct acct;
+    split_account* sa = nullptr;    // set while locked as a split account
+    bool merge = false;
+
+    locked_side(ftx_db& db, size_t a)
+        : acct(db, a) {
+    }
+    // Is this side limited to one slot’s balance and room?
+    bool one_slot() const {
+        return this->sa && !this->merge;
+    }
+    long read() {
+        if (this->one_slot()) {
+            return this->sa->slots[slotindex].balance;
+        } else if (this->sa) {
+            long total = 0;
+            for (int i = 0; i != nslots; ++i) {
+                total += this->sa->slots[i].balance;
+            }
+            return total;
+        }
+        long bal;
+        this->acct.read(nullptr, 0, &bal);
+        return bal;
+    }
+    long cap() {
+        if (this->one_slot()) {
+            return this->sa->slots[slotindex].cap;
+        }
+        return this->acct.db.max_balance;
+    }
+    void write(long bal) {
+        if (this->one_slot()) {
+            this->sa->slots[slotindex].balance = bal;
+        } else if (this->sa) {
+            this->sa->spread(bal, this->acct.db.max_balance);
+        } else {
+            this->acct.write(bal);
+        }
+    }
+    void unlock() {
+        if (this->one_slot()) {
+            this->sa->slots[slotindex].m.unlock();
+        } else if (this->sa) {
+            for (int i = nslots; i != 0; --i) {
+                this->sa->slots[i - 1].m.unlock();
+            }
+        } else if (this->acct.locked) {
+            this->acct.unlock();
+        }
+        this->sa = nullptr;
+    }
+};
+
+
+// lock_side(side)
+//    Lock `side`: if the account is split, the calling thread’s slot or,
+//    with `side.merge`, every slot; otherwise the account itself. Returns
+//    the account index if the account should be split first (its lock
+//    was busy too often), or `SIZE_MAX` on success.
+
+static size_t lock_side(locked_side& side) {
+    size_t a = side.acct.aindex;
+    while (true) {
+        if (auto sa = split[a].load(std::memory_order_acquire)) {
+            side.sa = sa;
+            if (side.merge) {
+                for (int i = 0; i != nslots; ++i) {
+                    sa->slots[i].m.lock();
+                }
+            } else {
+                sa->slots[slotindex].m.lock();
+            }
+            return SIZE_MAX;
+        }
+        if (side.acct.try_lock()) {
+            // An uncontended lock cools the account
+            if (unsigned n = nbusy[a].load(std::memory_order_relaxed)) {
+                nbusy[a].store(n - 1, std::memory_order_relaxed);
+            }
+        } else if ((nbusy[a] += 4) >= split_threshold) {
+            return a;
+        } else {
+            side.acct.lock();
+        }
+        // The account may have been split while we waited
+        if (!split[a].load(std::memory_order_acquire)) {
+            return SIZE_MAX;
+        }
+        side.acct.unlock();
+    }
+}
+
+
+// transfer(db, a, b, amount, stats)
+//    Move up to `amount` from account `a` to account `b`, exactly as if
+//    neither were split, splitting either account if its lock is busy
+//    too often.
+
+static void transfer(ftx_db& db, size_t a, size_t b, double amount,
+                     thread_stats& stats) {
+    locked_side side1{db, a};
+    locked_side side2{db, b};
+    locked_side& first = a < b ? side1 : side2;
+    locked_side& second = a < b ? side2 : side1;
+    long bal[2];
+
+    while (true) {
+        // Lock both sides in account order; split hot accounts unlocked
+        size_t hot = lock_side(first);
+        if (hot == SIZE_MAX) {
+            hot = lock_side(second);
+            if (hot == SIZE_MAX) {
+                // Read current balances
+                bal[0] = side1.read();
+                bal[1] = side2.read();
+
+                // Merge slots that would clip the transfer, and retry
+                bool short1 = side1.one_slot() && bal[0] < long(amount);
+                bool short2 = side2.one_slot()
+                    && side2.cap() - bal[1] < long(amount);
+                if (!short1 && !short2) {
+                    break;
+                }
+                second.unlock();
+                first.unlock();
+                side1.merge |= short1;
+                side2.merge |= short2;
+                continue;
+            }
+            first.unlock();
+        }
+        make_split(db, hot);
+    }
+
+    // Model network delay or heavy computation
+    usleep(1);
+
+    // Compute amount to transfer
+    long delta = std::min(bal[0], (long) amount);
+    delta = std::max(std::min(delta, side2.cap() - bal[1]), 0L);
+    bal[0] -= delta;
+    bal[1] += delta;
+
+    // Update balances
+    side1.write(bal[0]);
+    side2.write(bal[1]);
+    if (side1.sa || side2.sa) {
+        ++stats.nsplit;
+        stats.nmerged += side1.merge || side2.merge;
+    }
+    second.unlock();
+    first.unlock();
+}
+
+
+static void transfer_thread(ftx_db& db, size_t nops, thread_stats& stats,
+                            int index, unsigned seed) {
+    slotindex = index % nslots;
 
-static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
-                            unsigned seed) {
     // Obtain a source of random account numbers
     std::default_random_engine randomness(seed);
     std::uniform_int_distribution pick_account(size_t(0), db.naccounts - 1);
@@ -24,38 +288,19 @@ static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
             continue;
         }
 
-        // Lock both accounts; prevent deadlock with lock ordering
-        ftx_acct acct1{db, aindex[0]};
-        ftx_acct acct2{db, aindex[1]};
-        std::unique_lock guard1{aindex[0] < aindex[1] ? acct1 : acct2};
-        std::unique_lock guard2{aindex[0] < aindex[1] ? acct2 : acct1};
-
-        // Read current balances
-        long bal[2];
-        acct1.read(nullptr, 0, &bal[0]);
-        acct2.read(nullptr, 0, &bal[1]);
-
-        // Model network delay or heavy computation
-        usleep(1);
-
-        // Compute amount to transfer
-        long delta = std::min(bal[0], (long) pick_amount(randomness));
-        delta = std::min(delta, 9999999 - bal[1]);
-        bal[0] -= delta;
-        bal[1] += delta;
-
-        // Update balances
-        acct1.write(bal[0]);
-        acct2.write(bal[1]);
+        transfer(db, aindex[0], aindex[1], pick_amount(randomness), stats);
 
         ++i;
     }
-    opcount = i;
+    stats.nops = i;
+    stats.end_time = monotonic_timestamp();
 }
 
 
-static void sbf_transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
-                                unsigned seed) {
+static void sbf_transfer_thread(ftx_db& db, size_t nops, thread_stats& stats,
+                                int index, unsigned seed) {
+    slotindex = index % nslots;
+
     // Obtain a source of random account numbers
     std::default_random_engine randomness(seed);
     std::uniform_int_distribution pick_sbf_account(size_t(0), size_t(2));
@@ -81,39 +326,18 @@ static void sbf_transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
             aindex[1] = pick_sbf_account(randomness);
         }
 
-        // Lock both accounts; prevent deadlock with lock ordering
-        ftx_acct acct1{db, aindex[0]};
-        ftx_acct acct2{db, aindex[1]};
-        std::unique_lock guard1{aindex[0] < aindex[1] ? acct1 : acct2};
-        std::unique_lock guard2{aindex[0] < aindex[1] ? acct2 : acct1};
-
-        // Read current balances
-        long bal[2];
-        acct1.read(nullptr, 0, &bal[0]);
-        acct2.read(nullptr, 0, &bal[1]);
-
-        // Model network delay or heavy computation
-        usleep(1);
-
-        // Compute amount to transfer
-        long delta = std::min(bal[0], (long) pick_amount(randomness));
-        delta = std::min(delta, 9999999 - bal[1]);
-        bal[0] -= delta;
-        bal[1] += delta;
-
-        // Update balances
-        acct1.write(bal[0]);
-        acct2.write(bal[1]);
+        transfer(db, aindex[0], aindex[1], pick_amount(randomness), stats);
 
         ++i;
     }
-    opcount = i;
+    stats.nops = i;
+    stats.end_time = monotonic_timestamp();
 }
 
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("i:D:j:J:n:").set_nthreads(4)
+    io61_args args = io61_args("i:D:j:J:n:mS").set_nthreads(4)
         .set_noperations(100'000)
         .set_ndistinguished_threads(1)
         .parse(argc, argv);
@@ -121,29 +345,37 @@ int main(int argc, char* argv[]) {
     // Allocate buffer, open files
     ftx_db* db = ftx_db::open_args(args);
     args.after_open(db->f, O_RDWR);
+    nslots = args.nthreads;
+    split.reset(new std::atomic<split_account*>[db->naccounts]());
+    nbusy.reset(new std::atomic<unsigned>[db->naccounts]());
     std::random_device seed_randomness;
     double start_time = monotonic_timestamp();
 
     // Run transfers
     std::vector<std::thread> th(args.nthreads);
-    std::vector<size_t> opcounts(args.nthreads, 0);
+    std::vector<thread_stats> stats(args.nthreads);
     for (int i = 0; i != args.nthreads; ++i) {
         if (i < args.ndistinguished_threads) {
             th[i] = std::thread(sbf_transfer_thread, std::ref(*db),
-                                args.noperations, std::ref(opcounts[i]),
-                                seed_randomness());
+                                args.noperations, std::ref(stats[i]),
+                                i, seed_randomness());
         } else {
             th[i] = std::thread(transfer_thread, std::ref(*db),
-                                args.noperations, std::ref(opcounts[i]),
-                                seed_randomness());
+                                args.noperations, std::ref(stats[i]),
+                                i, seed_randomness());
         }
     }
 
     size_t totalops = 0;
     for (int i = 0; i != args.nthreads; ++i) {
         th[i].join();
-        totalops += opcounts[i];
+        totalops += stats[i].nops;
+    }
+    size_t nsplit = 0;
+    for (size_t a = 0; a != db->naccounts; ++a) {
+        nsplit += split[a] != nullptr;
     }
+    merge_splits(*db);
 
     // Flush and close
     delete db;
@@ -157,4 +389,12 @@ int main(int argc, char* argv[]) {
             totalops, totalops == 1 ? "operation" : "operations",
             (int) usage.ru_utime.tv_sec, (int) usage.ru_utime.tv_usec,
             end_time - start_time);
+    for (int i = 0; i != args.nthreads; ++i) {
+        fprintf(stderr, "  thread %d (%s): %.0f operations/s, %zu on split accounts, %zu merged\n",
+                i, i < args.ndistinguished_threads ? "sbf" : "customer",
+                stats[i].nops / (stats[i].end_time - start_time),
+                stats[i].nsplit, stats[i].nmerged);
+    }
+    fprintf(stderr, "%zu split %s\n", nsplit,
+            nsplit == 1 ? "account" : "accounts");
 }
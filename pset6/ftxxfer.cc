@@ -2,66 +2,47 @@
 #include <sys/resource.h>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
-// Usage: ./ftxxfer [-j NTHREADS] [-n NOPS] [FILE]
+// Usage: ./ftxxfer [-j NTHREADS] [-n NOPS] [-T BATCH] [-m] [-S] [-U] [FILE]
 //    Perform NOPS * NTHREADS “bank transfers” within FILE.
+//    With `-U`, accounts are locked in the order they are picked, which
+//    can deadlock; io61_lock detects that and the thread backs off.
+//    With `-T`, each thread groups BATCH transfers into one `ftx_txn`,
+//    which locks the accounts they touch once. Each transfer still
+//    models its own delay while the batch’s locks are held.
+
+static bool unordered;
+static size_t batch_size;
+static std::atomic<size_t> nbackoffs;
 
 static void transfer_thread(ftx_db& db, size_t nops, size_t& opcount,
                             unsigned seed) {
-    // Obtain a source of random account numbers
-    std::mt19937 randomness(seed);
-    std::uniform_int_distribution pick_account(size_t(0), db.naccounts - 1);
-    std::normal_distribution pick_amount(100.0, 10.0);
-
-    size_t i = 0;
-    while (i != nops) {
-        // Pick two random accounts for transfer
-        size_t aindex[2] = {
-            pick_account(randomness), pick_account(randomness)
-        };
-        if (aindex[0] == aindex[1]) {
-            continue;
-        }
-
-        // Lock both accounts; prevent deadlock with lock ordering
-        ftx_acct acct1{db, aindex[0]};
-        ftx_acct acct2{db, aindex[1]};
-        std::unique_lock guard1{aindex[0] < aindex[1] ? acct1 : acct2};
-        std::unique_lock guard2{aindex[0] < aindex[1] ? acct2 : acct1};
-
-        // Read current balances
-        long bal[2];
-        acct1.read(nullptr, 0, &bal[0]);
-        acct2.read(nullptr, 0, &bal[1]);
-
-        // Model network delay or heavy computation
-        usleep(1);
-
-        // Compute amount to transfer
-        long delta = std::min(bal[0], (long) pick_amount(randomness));
-        delta = std::min(delta, 9999999 - bal[1]);
-        bal[0] -= delta;
-        bal[1] += delta;
-
-        // Update balances
-        acct1.write(bal[0]);
-        acct2.write(bal[1]);
-
-        ++i;
+    if (batch_size > 1) {
+        opcount = ftx_batch_transfers(db, nops, seed, batch_size);
+    } else {
+        opcount = ftx_transfers(db, nops, seed, unordered, &nbackoffs);
     }
-    opcount = i;
 }
 
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_args args = io61_args("i:D:j:n:").set_nthreads(4)
+    io61_args args = io61_args("i:D:j:n:T:mSU").set_nthreads(4)
         .set_noperations(100'000)
         .parse(argc, argv);
+    if (args.unordered && args.batch_size > 1) {
+        // batches always lock in account order
+        args.usage();
+        exit(1);
+    }
 
     // Allocate buffer, open files
     ftx_db* db = ftx_db::open_args(args);
     args.after_open(db->f, O_RDWR);
+    unordered = args.unordered;
+    batch_size = args.batch_size;
+    io61_set_deadlock_detection(db->f, unordered);
     std::random_device seed_randomness;
     double start_time = monotonic_timestamp();
 
@@ -92,4 +73,8 @@ int main(int argc, char* argv[]) {
             totalops, totalops == 1 ? "operation" : "operations",
             (int) usage.ru_utime.tv_sec, (int) usage.ru_utime.tv_usec,
             end_time - start_time);
+    if (unordered) {
+        fprintf(stderr, "%zu deadlock %s\n", nbackoffs.load(),
+                nbackoffs == 1 ? "backoff" : "backoffs");
+    }
 }
@@ -230,6 +230,13 @@ io61_args& io61_args::parse(int argc, char** argv) {
                 goto usage;
             }
             break;
+        case 'T':
+            if (auto sz = parse_size(optarg, 1)) {
+                this->batch_size = *sz;
+            } else {
+                goto usage;
+            }
+            break;
         case 'l':
             this->read_lines = true;
             break;
@@ -271,6 +278,18 @@ io61_args& io61_args::parse(int argc, char** argv) {
         case 'M':
             this->modify = true;
             break;
+        case 'm':
+            this->mmap = true;
+            break;
+        case 'S':
+            this->shadow = true;
+            break;
+        case 'U':
+            this->unordered = true;
+            break;
+        case 'E':
+            this->lock_exclusive = true;
+            break;
         case 'D':
             this->delay = strtod(optarg, &endptr);
             if (endptr == optarg || *endptr) {
@@ -420,6 +439,9 @@ void io61_args::usage() {
     if (strchr(this->opts, 't')) {
         fprintf(stderr, "    -t STRIDE     Set stride (default %zu)\n", this->stride);
     }
+    if (strchr(this->opts, 'T')) {
+        fprintf(stderr, "    -T BATCH      Group BATCH transfers per transaction (default %zu)\n", this->batch_size);
+    }
     if (strchr(this->opts, 'p')) {
         fprintf(stderr, "    -p POS        Set initial file position\n");
     }
@@ -474,6 +496,18 @@ void io61_args::usage() {
     if (strchr(this->opts, 'M')) {
         fprintf(stderr, "    -M            Modify input file in place\n");
     }
+    if (strchr(this->opts, 'm')) {
+        fprintf(stderr, "    -m            Memory-map the account database\n");
+    }
+    if (strchr(this->opts, 'S')) {
+        fprintf(stderr, "    -S            Keep balances in binary until exit\n");
+    }
+    if (strchr(this->opts, 'U')) {
+        fprintf(stderr, "    -U            Lock without ordering; back off on deadlock\n");
+    }
+    if (strchr(this->opts, 'E')) {
+        fprintf(stderr, "    -E            Use exclusive locks for reading\n");
+    }
 }
 
 void io61_args::after_open() {
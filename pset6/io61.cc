@@ -4,6 +4,9 @@
 #include <mutex>
 #include <shared_mutex>
 #include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -11,6 +14,82 @@
 //    YOUR CODE HERE!
 
 
+// io61_lockstripe
+//    Range locks are kept in stripes. The file is divided into
+//    `io61_lockunit`-byte units, and unit `u` belongs to stripe
+//    `u % io61_nlockstripes`. A stripe records every held range that
+//    overlaps one of its units, so a range spanning several units is
+//    recorded in several stripes. Each stripe has its own mutex and
+//    condition variable: locks on different units rarely contend, and
+//    a thread waiting for a range sleeps on the stripe where it found
+//    the conflict.
+
+static constexpr off_t io61_lockunit = 64;
+static constexpr int io61_nlockstripes = 64;
+
+struct io61_lockowner;
+
+struct io61_heldrange {
+    off_t first;                // [first, last)
+    off_t last;
+    io61_lockowner* owner;      // thread holding the range
+    bool exclusive;             // LOCK_EX (vs. LOCK_SH)?
+};
+
+struct alignas(64) io61_lockstripe {
+    std::mutex m;
+    std::condition_variable cv;
+    int nwaiters = 0;                   // threads waiting on `cv`
+    std::vector<io61_heldrange> held;
+    std::vector<io61_heldrange> xwaiting;   // blocked LOCK_EX requests
+};
+
+
+// io61_lockowner
+//    Each thread’s node in the wait-for graph used for deadlock
+//    detection. `waits_for` has one edge per range that blocks this
+//    thread: every conflicting held range and every conflicting waiting
+//    exclusive request. An edge names the range, so unlocking a range
+//    removes exactly the edges it caused. Edges are only added when a
+//    thread is about to sleep, under `io61_waitgraph_mutex`, so
+//    uncontended locking never touches the graph.
+
+struct io61_waitedge {
+    io61_lockowner* owner;      // thread holding or awaiting the range
+    const io61_file* f;
+    off_t first;                // [first, last)
+    off_t last;
+};
+
+struct io61_lockowner {
+    std::vector<io61_waitedge> waits_for;
+    unsigned mark = 0;          // for `io61_waitgraph_add`’s search
+};
+
+static thread_local io61_lockowner io61_self;
+static std::mutex io61_waitgraph_mutex;
+static std::vector<io61_lockowner*> io61_waiters;   // owners with edges
+
+
+// io61_pslot
+//    A page of the positioned-mode cache. Page `p` of the file can only
+//    live in slot `p % io61_npslots`, so a lookup touches one slot. Each
+//    slot has its own reader/writer lock: hits from `io61_pread` share
+//    it, while fills and `io61_pwrite` take it exclusively. Threads
+//    working on different pages never contend.
+
+static constexpr off_t io61_pslotsz = 4096;
+static constexpr int io61_npslots = 128;
+
+struct alignas(64) io61_pslot {
+    std::shared_mutex m;
+    off_t tag = -1;          // offset of first character in `buf`, or -1
+    off_t end_tag = -1;      // offset one past last valid character
+    bool dirty = false;      // has `buf` been written?
+    unsigned char buf[io61_pslotsz];
+};
+
+
 // io61_file
 //    Data structure for io61 file wrappers.
 
@@ -19,16 +98,23 @@ struct io61_file {
     int mode;        // O_RDONLY, O_WRONLY, or O_RDWR
     bool seekable;   // is this file seekable?
 
-    // Single-slot cache
+    // Stream cache. Stream I/O (`io61_read`, `io61_write`, and friends)
+    // is not thread-safe: only one thread may use a file in stream mode.
     static constexpr off_t cbufsz = 8192;
     unsigned char cbuf[cbufsz];
     off_t tag;       // offset of first character in `cbuf`
     off_t pos_tag;   // next offset to read or write (non-positioned mode)
     off_t end_tag;   // offset one past last valid character in `cbuf`
 
-    // Positioned mode
     bool dirty = false;       // has cache been written?
-    bool positioned = false;  // is cache in positioned mode?
+
+    // Positioned mode
+    std::atomic<bool> positioned = false;     // used positioned I/O?
+    std::unique_ptr<io61_pslot[]> pslots;     // if opened O_RDWR
+
+    // Range locks
+    io61_lockstripe stripes[io61_nlockstripes];
+    bool detect_deadlock = false;   // see io61_set_deadlock_detection
 };
 
 
@@ -52,6 +138,9 @@ io61_file* io61_fdopen(int fd, int mode) {
         f->tag = f->pos_tag = f->end_tag = 0;
     }
     f->dirty = f->positioned = false;
+    if (f->mode == O_RDWR) {
+        f->pslots.reset(new io61_pslot[io61_npslots]);
+    }
     return f;
 }
 
@@ -181,12 +270,12 @@ ssize_t io61_write(io61_file* f, const unsigned char* buf, size_t sz) {
 //    data cached for reading and seeks to the logical file position.
 
 static int io61_flush_dirty(io61_file* f);
-static int io61_flush_dirty_positioned(io61_file* f);
+static int io61_flush_positioned(io61_file* f);
 static int io61_flush_clean(io61_file* f);
 
 int io61_flush(io61_file* f) {
-    if (f->dirty && f->positioned) {
-        return io61_flush_dirty_positioned(f);
+    if (f->positioned) {
+        return io61_flush_positioned(f);
     } else if (f->dirty) {
         return io61_flush_dirty(f);
     } else {
@@ -197,13 +286,21 @@ int io61_flush(io61_file* f) {
 
 // io61_seek(f, off)
 //    Changes the file pointer for file `f` to `off` bytes into the file.
-//    Returns 0 on success and -1 on failure.
+//    Returns 0 on success and -1 on failure. Seeking a file used for
+//    positioned I/O returns it to stream mode: its positioned cache is
+//    written back and emptied, so later `io61_pread`s see stream writes.
 
 int io61_seek(io61_file* f, off_t off) {
     int r = io61_flush(f);
     if (r == -1) {
         return -1;
     }
+    if (f->positioned) {
+        for (int i = 0; i != io61_npslots; ++i) {
+            std::unique_lock guard(f->pslots[i].m);
+            f->pslots[i].tag = f->pslots[i].end_tag = -1;
+        }
+    }
     off_t roff = lseek(f->fd, off, SEEK_SET);
     if (roff == -1) {
         return -1;
@@ -257,21 +354,19 @@ static int io61_flush_dirty(io61_file* f) {
     return 0;
 }
 
-static int io61_flush_dirty_positioned(io61_file* f) {
-    // Called when `f`’s cache is dirty and positioned.
-    // Uses `pwrite`; does not change file position.
-    off_t flush_tag = f->tag;
-    while (flush_tag != f->end_tag) {
-        ssize_t nw = pwrite(f->fd, &f->cbuf[flush_tag - f->tag],
-                            f->end_tag - flush_tag, flush_tag);
-        if (nw >= 0) {
-            flush_tag += nw;
-        } else if (errno != EINTR && errno != EINVAL) {
-            return -1;
+static int io61_pslot_flush(io61_file* f, io61_pslot& s);
+
+static int io61_flush_positioned(io61_file* f) {
+    // Called when `f` has been used for positioned I/O.
+    // Writes back every dirty slot; does not change file position.
+    int r = 0;
+    for (int i = 0; i != io61_npslots; ++i) {
+        std::unique_lock guard(f->pslots[i].m);
+        if (io61_pslot_flush(f, f->pslots[i]) == -1) {
+            r = -1;
         }
     }
-    f->dirty = false;
-    return 0;
+    return r;
 }
 
 static int io61_flush_clean(io61_file* f) {
@@ -296,18 +391,25 @@ static int io61_flush_clean(io61_file* f) {
 //    This function can only be called when `f` was opened in read/write
 //    more (O_RDWR).
 
-static int io61_pfill(io61_file* f, off_t off);
+static io61_pslot& io61_pslot_for(io61_file* f, off_t off);
+static int io61_pfill(io61_file* f, io61_pslot& s, off_t tag);
 
 ssize_t io61_pread(io61_file* f, unsigned char* buf, size_t sz,
                    off_t off) {
-    if (!f->positioned || off < f->tag || off >= f->end_tag) {
-        if (io61_pfill(f, off) == -1) {
+    io61_pslot& s = io61_pslot_for(f, off);
+    off_t tag = off - off % io61_pslotsz;
+    std::shared_lock rguard(s.m);
+    std::unique_lock<std::shared_mutex> wguard;
+    if (s.tag != tag) {
+        // Miss: refill the slot exclusively, then copy out under that lock
+        rguard.unlock();
+        wguard = std::unique_lock(s.m);
+        if (s.tag != tag && io61_pfill(f, s, tag) == -1) {
             return -1;
         }
     }
-    size_t nleft = f->end_tag - off;
-    size_t ncopy = std::min(sz, nleft);
-    memcpy(buf, &f->cbuf[off - f->tag], ncopy);
+    size_t ncopy = std::min(sz, size_t(std::max(s.end_tag - off, off_t(0))));
+    memcpy(buf, &s.buf[off - tag], ncopy);
     return ncopy;
 }
 
@@ -321,37 +423,76 @@ ssize_t io61_pread(io61_file* f, unsigned char* buf, size_t sz,
 
 ssize_t io61_pwrite(io61_file* f, const unsigned char* buf, size_t sz,
                     off_t off) {
-    if (!f->positioned || off < f->tag || off >= f->end_tag) {
-        if (io61_pfill(f, off) == -1) {
-            return -1;
-        }
+    io61_pslot& s = io61_pslot_for(f, off);
+    off_t tag = off - off % io61_pslotsz;
+    std::unique_lock guard(s.m);
+    if (s.tag != tag && io61_pfill(f, s, tag) == -1) {
+        return -1;
     }
-    size_t nleft = f->end_tag - off;
-    size_t ncopy = std::min(sz, nleft);
-    memcpy(&f->cbuf[off - f->tag], buf, ncopy);
-    f->dirty = true;
+    size_t ncopy = std::min(sz, size_t(tag + io61_pslotsz - off));
+    if (off > s.end_tag) {
+        // Writing past end of file: the gap reads as zeros
+        memset(&s.buf[s.end_tag - tag], 0, off - s.end_tag);
+    }
+    memcpy(&s.buf[off - tag], buf, ncopy);
+    s.end_tag = std::max(s.end_tag, off_t(off + ncopy));
+    s.dirty = true;
     return ncopy;
 }
 
 
-// io61_pfill(f, off)
-//    Fill the single-slot cache with data including offset `off`.
-//    The handout code rounds `off` down to a multiple of 8192.
+// io61_pslot_for(f, off)
+//    Return the cache slot that holds offset `off`.
 
-static int io61_pfill(io61_file* f, off_t off) {
-    assert(f->mode == O_RDWR);
-    if (f->dirty && io61_flush(f) == -1) {
-        return -1;
+static io61_pslot& io61_pslot_for(io61_file* f, off_t off) {
+    assert(f->mode == O_RDWR && off >= 0);
+    if (!f->positioned.load(std::memory_order_relaxed)) {
+        f->positioned = true;
     }
+    return f->pslots[(off / io61_pslotsz) % io61_npslots];
+}
 
-    off = off - (off % 8192);
-    ssize_t nr = pread(f->fd, f->cbuf, f->cbufsz, off);
-    if (nr == -1) {
+
+// io61_pfill(f, s, tag)
+//    Fill slot `s` with the page starting at offset `tag`, first
+//    writing back the page it holds if that is dirty. The caller must
+//    hold `s.m` exclusively.
+
+static int io61_pfill(io61_file* f, io61_pslot& s, off_t tag) {
+    if (io61_pslot_flush(f, s) == -1) {
         return -1;
     }
-    f->tag = off;
-    f->end_tag = off + nr;
-    f->positioned = true;
+    ssize_t nr;
+    while (true) {
+        nr = pread(f->fd, s.buf, io61_pslotsz, tag);
+        if (nr >= 0) {
+            break;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            return -1;
+        }
+    }
+    s.tag = tag;
+    s.end_tag = tag + nr;
+    return 0;
+}
+
+
+// io61_pslot_flush(f, s)
+//    Write slot `s` back to the file if it is dirty. The caller must
+//    hold `s.m` exclusively.
+
+static int io61_pslot_flush(io61_file* f, io61_pslot& s) {
+    off_t flush_tag = s.tag;
+    while (s.dirty && flush_tag != s.end_tag) {
+        ssize_t nw = pwrite(f->fd, &s.buf[flush_tag - s.tag],
+                            s.end_tag - flush_tag, flush_tag);
+        if (nw >= 0) {
+            flush_tag += nw;
+        } else if (errno != EINTR && errno != EINVAL) {
+            return -1;
+        }
+    }
+    s.dirty = false;
     return 0;
 }
 
@@ -359,11 +500,233 @@ static int io61_pfill(io61_file* f, off_t off) {
 
 // FILE LOCKING FUNCTIONS
 
+// io61_lock_stripes(off, len, sv)
+//    Store the indexes of the stripes that cover `[off, off + len)` in
+//    `sv`, in increasing order, and return how many there are. Stripe
+//    mutexes are always acquired in this order.
+
+static int io61_lock_stripes(off_t off, off_t len, int* sv) {
+    off_t first = off / io61_lockunit;
+    off_t last = (off + len - 1) / io61_lockunit;
+    int n = 0;
+    if (last - first >= io61_nlockstripes - 1) {
+        for (; n != io61_nlockstripes; ++n) {
+            sv[n] = n;
+        }
+    } else {
+        for (off_t u = first; u <= last; ++u, ++n) {
+            sv[n] = u % io61_nlockstripes;
+        }
+        std::sort(sv, sv + n);
+    }
+    return n;
+}
+
+
+// io61_waitgraph_add(self, edges), io61_waitgraph_clear(self),
+// io61_waitgraph_release(owner, f, off, len)
+//    `io61_waitgraph_add` records that `self` is about to wait for every
+//    range in `edges`. It returns -1 without adding anything if some
+//    edge would close a cycle in the wait-for graph. `io61_waitgraph_clear`
+//    removes `self`’s edges when it wakes. `io61_waitgraph_release`
+//    removes every edge to `owner`’s range `[off, off + len)` in `f`,
+//    once that range is unlocked or its request is abandoned. The caller
+//    must hold `io61_waitgraph_mutex`.
+
+static void io61_waitgraph_clear(io61_lockowner* self) {
+    if (!self->waits_for.empty()) {
+        self->waits_for.clear();
+        auto it = std::find(io61_waiters.begin(), io61_waiters.end(), self);
+        *it = io61_waiters.back();
+        io61_waiters.pop_back();
+    }
+}
+
+static int io61_waitgraph_add(io61_lockowner* self,
+                              const std::vector<io61_waitedge>& edges) {
+    // Depth-first search from the new edges’ owners for `self`. Every
+    // edge was checked when added, so any new cycle passes through `self`.
+    static unsigned gen = 0;
+    ++gen;
+    std::vector<io61_lockowner*> stack;
+    for (auto& e : edges) {
+        stack.push_back(e.owner);
+    }
+    while (!stack.empty()) {
+        io61_lockowner* p = stack.back();
+        stack.pop_back();
+        if (p == self) {
+            return -1;
+        } else if (p->mark != gen) {
+            p->mark = gen;
+            for (auto& e : p->waits_for) {
+                stack.push_back(e.owner);
+            }
+        }
+    }
+    if (self->waits_for.empty() && !edges.empty()) {
+        io61_waiters.push_back(self);
+    }
+    self->waits_for.insert(self->waits_for.end(), edges.begin(), edges.end());
+    return 0;
+}
+
+static void io61_waitgraph_release(io61_lockowner* owner, const io61_file* f,
+                                   off_t off, off_t len) {
+    for (size_t i = 0; i != io61_waiters.size(); ) {
+        io61_lockowner* w = io61_waiters[i];
+        std::erase_if(w->waits_for, [&] (const io61_waitedge& e) {
+            return e.owner == owner && e.f == f
+                && e.first == off && e.last == off + len;
+        });
+        if (w->waits_for.empty()) {
+            io61_waiters[i] = io61_waiters.back();
+            io61_waiters.pop_back();
+        } else {
+            ++i;
+        }
+    }
+}
+
+
+// io61_lock_remove(v, off, len)
+//    Remove the calling thread’s entry for `[off, off + len)` from `v`.
+//    Returns 0 on success and -1 if there is no such entry.
+
+static int io61_lock_remove(std::vector<io61_heldrange>& v,
+                            off_t off, off_t len) {
+    for (auto it = v.begin(); it != v.end(); ++it) {
+        if (it->first == off && it->last == off + len
+            && it->owner == &io61_self) {
+            *it = v.back();
+            v.pop_back();
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+// io61_lock_acquire(f, off, len, locktype, wait)
+//    Lock `[off, off + len)` in `f` with `locktype` (LOCK_EX or LOCK_SH).
+//    If the lock conflicts, either sleeps until the conflict goes away
+//    and tries again (if `wait`), or returns -1 with `errno` set to
+//    EAGAIN. If waiting would deadlock and `f` detects deadlock, returns
+//    -1 with `errno` set to EDEADLK.
+//
+//    Exclusive locks conflict with any overlapping lock; shared locks
+//    conflict with overlapping exclusive locks. Writers are preferred:
+//    a waiting exclusive request is listed in `xwaiting` on each of its
+//    stripes, and new shared requests that overlap it wait behind it.
+
+static int io61_lock_acquire(io61_file* f, off_t off, off_t len,
+                             int locktype, bool wait) {
+    bool exclusive = locktype == LOCK_EX;
+    int sv[io61_nlockstripes];
+    int n = io61_lock_stripes(off, len, sv);
+    bool listed = false;        // are we in `xwaiting`?
+    static thread_local std::vector<io61_waitedge> edges;
+    while (true) {
+        for (int i = 0; i != n; ++i) {
+            f->stripes[sv[i]].m.lock();
+        }
+        if (listed) {
+            // Leave `xwaiting`; wake readers that were waiting behind us
+            for (int i = 0; i != n; ++i) {
+                io61_lockstripe& st = f->stripes[sv[i]];
+                io61_lock_remove(st.xwaiting, off, len);
+                if (st.nwaiters != 0) {
+                    st.cv.notify_all();
+                }
+            }
+            listed = false;
+        }
+
+        // Find the first conflict; with deadlock detection, find every
+        // conflicting range, since any of their owners may close a cycle
+        int conflict = -1;
+        bool all = f->detect_deadlock && wait;
+        edges.clear();
+        for (int i = 0; i != n && (conflict < 0 || all); ++i) {
+            io61_lockstripe& st = f->stripes[sv[i]];
+            for (auto& r : st.held) {
+                if (r.first < off + len && off < r.last
+                    && (exclusive || r.exclusive)) {
+                    conflict = conflict < 0 ? i : conflict;
+                    if (!all) {
+                        break;
+                    }
+                    edges.push_back({r.owner, f, r.first, r.last});
+                }
+            }
+            for (auto& r : st.xwaiting) {
+                if (exclusive || (conflict >= 0 && !all)) {
+                    break;
+                } else if (r.first < off + len && off < r.last) {
+                    conflict = conflict < 0 ? i : conflict;
+                    edges.push_back({r.owner, f, r.first, r.last});
+                }
+            }
+        }
+        if (conflict < 0) {
+            for (int i = 0; i != n; ++i) {
+                f->stripes[sv[i]].held.push_back(
+                    {off, off + len, &io61_self, exclusive}
+                );
+                f->stripes[sv[i]].m.unlock();
+            }
+            return 0;
+        }
+
+        if (!wait) {
+            errno = EAGAIN;
+        } else if (f->detect_deadlock) {
+            std::lock_guard wguard(io61_waitgraph_mutex);
+            if (io61_waitgraph_add(&io61_self, edges) == -1) {
+                // Threads waiting behind our earlier request stop waiting
+                io61_waitgraph_release(&io61_self, f, off, len);
+                errno = EDEADLK;
+                wait = false;
+            }
+        }
+        if (wait && exclusive) {
+            for (int i = 0; i != n; ++i) {
+                f->stripes[sv[i]].xwaiting.push_back(
+                    {off, off + len, &io61_self, true}
+                );
+            }
+            listed = true;
+        }
+
+        // Keep the conflicting stripe’s mutex so its release can’t be missed
+        for (int i = 0; i != n; ++i) {
+            if (i != conflict) {
+                f->stripes[sv[i]].m.unlock();
+            }
+        }
+        io61_lockstripe& st = f->stripes[sv[conflict]];
+        std::unique_lock guard(st.m, std::adopt_lock);
+        if (!wait) {
+            return -1;
+        }
+        ++st.nwaiters;
+        st.cv.wait(guard);
+        --st.nwaiters;
+        if (f->detect_deadlock) {
+            std::lock_guard wguard(io61_waitgraph_mutex);
+            io61_waitgraph_clear(&io61_self);
+        }
+    }
+}
+
+
 // io61_try_lock(f, off, len, locktype)
 //    Attempts to acquire a lock on offsets `[off, off + len)` in file `f`.
-//    `locktype` must be `LOCK_EX`, which requests an exclusive lock. At most
-//    one exclusive lock can be held on any offset of file data at a time.
-//    Returns 0 if the lock was acquired and -1 if it was not.
+//    `locktype` must be `LOCK_EX`, which requests an exclusive lock, or
+//    `LOCK_SH`, which requests a shared lock. At most one exclusive lock
+//    can be held on any offset of file data at a time, and never at the
+//    same time as a shared lock on that offset; any number of shared locks
+//    can coexist. Returns 0 if the lock was acquired and -1 if it was not.
 //
 //    This function does not block; if the lock cannot be required, it returns
 //    -1 right away.
@@ -373,55 +736,87 @@ static int io61_pfill(io61_file* f, off_t off) {
 //    always lock nonoverlapping ranges.
 
 int io61_try_lock(io61_file* f, off_t off, off_t len, int locktype) {
-    (void) f;
     assert(off >= 0 && len >= 0);
-    assert(locktype == LOCK_EX);
+    assert(locktype == LOCK_EX || locktype == LOCK_SH);
     if (len == 0) {
         return 0;
     }
-    return 0;
+    return io61_lock_acquire(f, off, len, locktype, false);
 }
 
 
 // io61_lock(f, off, len, locktype)
 //    Acquire a lock on offsets `[off, off + len)` in file `f`.
-//    `locktype` must be `LOCK_EX`, which requests an exclusive lock; at most
-//    one exclusive lock can be held on any offset of file data at a time.
+//    `locktype` must be `LOCK_EX`, which requests an exclusive lock, or
+//    `LOCK_SH`, which requests a shared lock (see `io61_try_lock`).
 //
 //    Returns 0 if the lock was acquired and -1 on error. Blocks until
 //    the lock can be acquired; the -1 return value is reserved for true
 //    error conditions, such as EDEADLK (a deadlock was detected). Note that
 //    your code need not detect deadlock.
+//
+//    Waiting threads sleep until a conflicting range is unlocked. If
+//    deadlock detection is enabled for `f`, a thread that would close a
+//    cycle of waiting threads gets EDEADLK instead; it should release
+//    its other locks and retry. A waiting exclusive request blocks new
+//    overlapping shared requests, so readers cannot starve writers.
 
 int io61_lock(io61_file* f, off_t off, off_t len, int locktype) {
     assert(off >= 0 && len >= 0);
-    assert(locktype == LOCK_EX);
+    assert(locktype == LOCK_EX || locktype == LOCK_SH);
     if (len == 0) {
         return 0;
     }
-    // The handout code polls using `io61_try_lock`.
-    while (io61_try_lock(f, off, len, locktype) != 0) {
-    }
-    return 0;
+    return io61_lock_acquire(f, off, len, locktype, true);
 }
 
 
 // io61_unlock(f, off, len)
 //    Release the lock on offsets `[off, off + len)` in file `f`.
 //    Returns 0 on success and -1 on error. The calling thread must have
-//    previously acquired a lock on that offset range.
+//    previously acquired a lock (of either type) on that offset range.
 
 int io61_unlock(io61_file* f, off_t off, off_t len) {
-    (void) f;
     assert(off >= 0 && len >= 0);
     if (len == 0) {
         return 0;
     }
+    int sv[io61_nlockstripes];
+    int n = io61_lock_stripes(off, len, sv);
+    for (int i = 0; i != n; ++i) {
+        io61_lockstripe& st = f->stripes[sv[i]];
+        std::lock_guard guard(st.m);
+        if (io61_lock_remove(st.held, off, len) == -1) {
+            // not locked: an error if nothing has been released yet
+            assert(i == 0);
+            errno = EINVAL;
+            return -1;
+        }
+        if (st.nwaiters != 0) {
+            st.cv.notify_all();
+        }
+    }
+    if (f->detect_deadlock) {
+        std::lock_guard wguard(io61_waitgraph_mutex);
+        io61_waitgraph_release(&io61_self, f, off, len);
+    }
     return 0;
 }
 
 
 
+// io61_set_deadlock_detection(f, enabled)
+//    Enable or disable deadlock detection for locks on `f`. When enabled,
+//    `io61_lock` returns -1 with `errno == EDEADLK` rather than block
+//    in a cycle of waiting threads. The check runs only when a thread
+//    is about to block.
+
+void io61_set_deadlock_detection(io61_file* f, bool enabled) {
+    f->detect_deadlock = enabled;
+}
+
+
+
 // HELPER FUNCTIONS
 // You shouldn't need to change these functions.
 
@@ -36,6 +36,7 @@ ssize_t io61_pwrite(io61_file* f, const unsigned char* buf, size_t sz,
 int io61_try_lock(io61_file* f, off_t start, off_t len, int locktype);
 int io61_lock(io61_file* f, off_t start, off_t len, int locktype);
 int io61_unlock(io61_file* f, off_t start, off_t len);
+void io61_set_deadlock_detection(io61_file* f, bool enabled);
 
 int io61_flush(io61_file* f);
 
@@ -56,6 +57,10 @@ struct io61_args {
     bool flush = false;                 // `-F`: flush output
     bool quiet = false;                 // `-q`: ignore errors
     bool modify = false;                // `-M`: modify in place
+    bool mmap = false;                  // `-m`: memory-map database
+    bool shadow = false;                // `-S`: binary balance shadow
+    bool unordered = false;             // `-U`: lock without ordering
+    bool lock_exclusive = false;        // `-E`: only exclusive locks
     bool exponential = false;           // `-X`: exponential distribution
     unsigned yield = 0;                 // `-y`: yield after output
     bool hint = false;                  // `-H`: make hints
@@ -74,6 +79,7 @@ struct io61_args {
     int nthreads = 1;                   // `-j`: number of threads
     int ndistinguished_threads = 0;     // `-J`: # distinguished threads
     size_t noperations = 0;             // `-n`: number of operations
+    size_t batch_size = 1;              // `-T`: transfers per transaction
 
     io61_args() = default;
     explicit io61_args(const char* opts, size_t block_size = 0);